@@ -0,0 +1,148 @@
+// example usage:
+// ./bench_cache 8 5
+// measures cache hit throughput with 1..8 worker threads, 5 seconds per run, once with a single
+// shard (same as one global lock) and once with the sharded cache used by the server.
+// ./bench_cache policies 16
+// replays the same zipf read trace (sizes of the images in img/african_elephant) through a 16 MB cache
+// with every eviction policy and prints their hit ratios. A miss stores the image, like /read does.
+
+#include "include/cache.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define NUM_KEYS 1024
+#define CACHE_BYTES ((size_t)64 << 20) // far more than NUM_KEYS entries need, so no key gets evicted.
+#define CACHE_SHARDS 16
+#define VALUE_SIZE 64 // small values, so the benchmark measures locking and not memcpy.
+#define ZIPF_KEYS 1000 // same key population and skew as the zipf load test of ldgen.
+#define ZIPF_S 0.99
+#define TRACE_LENGTH 1000000
+#define ONE_OFF_PERCENT 10 // share of the trace that reads keys seen only once (a scan).
+
+std::atomic<bool> stop;
+
+// Every worker reads keys that are all in the cache, so every call is a hit.
+double run(ShardedCache& cache, int numthreads, int duration_seconds)
+{
+    std::vector<std::thread> threads;
+    std::vector<long long> hits(numthreads, 0);
+    stop = false;
+
+    for (int id = 0; id < numthreads; id++)
+    {
+        threads.emplace_back([&, id]() {
+            CacheValue value;
+            long long i = id, local_hits = 0; // counted locally to avoid false sharing on hits.
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                std::string key = std::to_string(i % NUM_KEYS);
+                if (cache.get(key, value))
+                    local_hits++;
+                i += 7;
+            }
+            hits[id] = local_hits;
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(duration_seconds));
+    stop = true;
+    for (auto& t : threads)
+        t.join();
+
+    long long total = 0;
+    for (long long h : hits)
+        total += h;
+    return (double)total / duration_seconds;
+}
+
+void compare_policies(size_t cache_bytes)
+{
+    std::vector<size_t> sizes;
+    for (const auto& entry : std::filesystem::directory_iterator("img/african_elephant"))
+        sizes.push_back(std::filesystem::file_size(entry.path()));
+    if (sizes.empty())
+    {
+        std::cerr << "No images found in img/african_elephant\n";
+        return;
+    }
+
+    std::vector<double> cdf;
+    double sum = 0;
+    for (int k = 0; k < ZIPF_KEYS; k++)
+    {
+        sum += 1.0 / std::pow(k + 1, ZIPF_S);
+        cdf.push_back(sum);
+    }
+    for (auto& c : cdf)
+        c /= sum;
+
+    // Every policy sees exactly the same trace.
+    std::vector<int> trace;
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<> dist(0.0, 1.0);
+    std::uniform_int_distribution<> percent(0, 99);
+    int one_off = ZIPF_KEYS;
+    for (int i = 0; i < TRACE_LENGTH; i++)
+    {
+        if (percent(gen) < ONE_OFF_PERCENT)
+            trace.push_back(one_off++);
+        else
+            trace.push_back(std::lower_bound(cdf.begin(), cdf.end(), dist(gen)) - cdf.begin());
+    }
+
+    std::cout << "policy\thit ratio\n";
+    for (std::string policy : {"fifo", "lru", "clock", "s3fifo", "wtinylfu"})
+    {
+        ShardedCache cache(CACHE_SHARDS, cache_bytes, 0.05, policy);
+        CacheValue value;
+        for (int k : trace)
+        {
+            std::string key = std::to_string(k);
+            if (!cache.get(key, value))
+                cache.put(key, std::make_shared<const std::string>(sizes[k % sizes.size()], 'x'));
+        }
+        ShardedCache::Stats st = cache.stats();
+        std::cout << policy << "\t" << (double)st.hits / (st.hits + st.misses) << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc == 3 && std::string(argv[1]) == "policies")
+    {
+        compare_policies((size_t)std::stoi(argv[2]) << 20);
+        return 0;
+    }
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage \n%s <max_threads> <duration_seconds>\n%s policies <cache_MB>\n", argv[0], argv[0]);
+        exit(0);
+    }
+    int max_threads = std::stoi(argv[1]);
+    int duration_seconds = std::stoi(argv[2]);
+
+    ShardedCache global(1, CACHE_BYTES, 1.0, "lru");
+    ShardedCache sharded(CACHE_SHARDS, CACHE_BYTES, 1.0, "lru");
+    CacheValue value = std::make_shared<const std::string>(VALUE_SIZE, 'x');
+    for (int i = 0; i < NUM_KEYS; i++)
+    {
+        global.put(std::to_string(i), value);
+        sharded.put(std::to_string(i), value);
+    }
+
+    std::cout << "threads\t1 shard (hits/sec)\t" << CACHE_SHARDS << " shards (hits/sec)\n";
+    for (int n = 1; n <= max_threads; n *= 2)
+    {
+        double g = run(global, n, duration_seconds);
+        double s = run(sharded, n, duration_seconds);
+        std::cout << n << "\t" << g << "\t" << s << std::endl;
+    }
+}
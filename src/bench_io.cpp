@@ -0,0 +1,128 @@
+// example usage:
+// ./bench_io 1024 5
+// writes a 1024 MB file (bench_io.data in the current directory) and measures random 4 KB reads
+// per second from it at queue depths 1, 2, 4, .. 128, 5 seconds per run, through io_uring with
+// registered buffers, io_uring with ordinary buffers, and the thread pool the database falls back
+// to. One thread keeps queue depth reads in flight: every completion issues the next read.
+// ./bench_io 1024 5 direct
+// the same with O_DIRECT, so the reads reach the device instead of the page cache.
+
+#include "include/disk_io.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define FILE_NAME "bench_io.data"
+#define BLOCK_BYTES 4096
+#define MAX_QUEUE_DEPTH 128
+
+std::atomic<bool> stop;
+std::atomic<long long> reads, outstanding;
+
+// One chain of reads: each completion checks the result and issues the next read into the same buffer.
+void issue(DiskIO& io, int fd, char* buf, uint64_t blocks, std::shared_ptr<std::mt19937_64> gen)
+{
+    uint64_t offset = (*gen)() % blocks * BLOCK_BYTES;
+    io.read(fd, buf, BLOCK_BYTES, offset, [&io, fd, buf, blocks, gen](int r) {
+        if (r != BLOCK_BYTES)
+        {
+            std::cerr << "Read failed: " << (r < 0 ? strerror(-r) : "short read") << "\n";
+            exit(1);
+        }
+        reads++;
+        if (stop.load(std::memory_order_relaxed))
+            outstanding--;
+        else
+            issue(io, fd, buf, blocks, gen);
+    });
+}
+
+double run(DiskIO& io, int fd, uint64_t blocks, int depth, bool fixed, int duration_seconds)
+{
+    std::vector<std::shared_ptr<char>> buffers;
+    std::vector<std::string> plain(depth, std::string(2 * BLOCK_BYTES, '\0'));
+    stop = false;
+    reads = 0;
+    outstanding = depth;
+    for (int i = 0; i < depth; i++)
+    {
+        char* buf;
+        if (fixed)
+        {
+            buffers.push_back(io.buffer(BLOCK_BYTES));
+            buf = buffers.back().get();
+        }
+        else // aligned inside a larger string, for O_DIRECT.
+            buf = &plain[i][0] + (BLOCK_BYTES - (uintptr_t)&plain[i][0] % BLOCK_BYTES) % BLOCK_BYTES;
+        issue(io, fd, buf, blocks, std::make_shared<std::mt19937_64>(i));
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(duration_seconds));
+    stop = true;
+    long long done = reads;
+    while (outstanding > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return (double)done / duration_seconds;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage \n%s <file_MB> <duration_seconds> [direct]\n", argv[0]);
+        exit(0);
+    }
+    size_t file_bytes = (size_t)std::stoi(argv[1]) << 20;
+    int duration_seconds = std::stoi(argv[2]);
+    bool direct = argc > 3 && std::string(argv[3]) == "direct";
+
+    int fd = open(FILE_NAME, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        perror(FILE_NAME);
+        return 1;
+    }
+    if ((size_t)st.st_size < file_bytes)
+    {
+        std::cout << "Writing " << FILE_NAME << std::endl;
+        std::string chunk(1 << 20, '\0');
+        std::mt19937 gen(42);
+        for (size_t written = 0; written < file_bytes; written += chunk.size())
+        {
+            for (auto& c : chunk)
+                c = gen();
+            if (pwrite(fd, chunk.data(), chunk.size(), written) != (ssize_t)chunk.size())
+            {
+                perror(FILE_NAME);
+                return 1;
+            }
+        }
+        fsync(fd);
+    }
+    close(fd);
+    fd = open(FILE_NAME, O_RDONLY | (direct ? O_DIRECT : 0));
+    uint64_t blocks = file_bytes / BLOCK_BYTES;
+
+    DiskIO uring(true, MAX_QUEUE_DEPTH, MAX_QUEUE_DEPTH, BLOCK_BYTES, 0);
+    DiskIO threads(false, MAX_QUEUE_DEPTH, 0, 0, MAX_QUEUE_DEPTH);
+    std::cout << "queue depth\t" << uring.backend() << " (reads/sec)\tio_uring (reads/sec)\tthreads (reads/sec)\n";
+    for (int depth = 1; depth <= MAX_QUEUE_DEPTH; depth *= 2)
+    {
+        double f = run(uring, fd, blocks, depth, true, duration_seconds);
+        double u = run(uring, fd, blocks, depth, false, duration_seconds);
+        double t = run(threads, fd, blocks, depth, false, duration_seconds);
+        std::cout << depth << "\t" << f << "\t" << u << "\t" << t << std::endl;
+    }
+    DiskIO::Stats s = uring.stats();
+    std::cout << "io_uring submit calls: " << s.submits << " for " << s.ops << " reads, largest batch: " << s.max_batch << "\n";
+    close(fd);
+}
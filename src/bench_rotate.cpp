@@ -0,0 +1,176 @@
+// example usage:
+// ./bench_rotate 3
+// decodes every image in img/african_elephant, then rotates all of them by 90, 180 and 270
+// degrees, 3 times each, with warpAffine (what the server did for every angle), OpenCV's
+// cv::rotate (transpose + flip) and rotate_image (the blocked kernel the server uses now), and
+// prints the average time per image. Decoding and encoding are not included.
+// Then it times the whole of what /rotate does with the same JPEGs and angles: decoding, rotating
+// and encoding them with imdecode / imencode (before) and with the server's reusable codec
+// (jpeg_codec.h), against rotating them losslessly without decoding (rotate_jpeg).
+// ./bench_rotate tiles 4
+// rotates one image scaled to 256x256 .. 4096x4096 by 45 degrees (warpAffine) with 1, 2, .. 4
+// threads, the result split into that many row tiles as with --rotate-tiles of the server, and
+// prints the time per rotation for every size and thread count.
+
+#include "include/rotate.h"
+#include "include/cpu_pool.h"
+#include "include/jpeg_codec.h"
+#include "include/jpeg_rotate.h"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace cv;
+
+#define IMAGE_DIR "img/african_elephant"
+
+// The rotation step of /rotate and /rotate2 before the right angle fast path.
+Mat warp_rotate(const Mat& img, int angle)
+{
+    Point2f center(img.cols / 2.0F, img.rows / 2.0F);
+    Mat rotation_matrix = getRotationMatrix2D(center, angle, 1);
+    Rect2f bbox = RotatedRect(Point2f(), img.size(), angle).boundingRect2f();
+    rotation_matrix.at<double>(0, 2) += bbox.width / 2.0 - img.cols / 2.0;
+    rotation_matrix.at<double>(1, 2) += bbox.height / 2.0 - img.rows / 2.0;
+    Mat rotated;
+    warpAffine(img, rotated, rotation_matrix, bbox.size());
+    return rotated;
+}
+
+Mat cv_rotate(const Mat& img, int angle)
+{
+    Mat rotated;
+    rotate(img, rotated, angle == 90 ? ROTATE_90_COUNTERCLOCKWISE : angle == 180 ? ROTATE_180 : ROTATE_90_CLOCKWISE);
+    return rotated;
+}
+
+// Average milliseconds per image of rotating every image by angle, repeats times.
+template <typename T, typename F>
+double run(const std::vector<T>& images, int angle, int repeats, F rotate_fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    size_t rotated = 0;
+    for (int i = 0; i < repeats; i++)
+        for (const T& img : images)
+            rotated += !rotate_fn(img, angle).empty(); // used, so the call is not optimized away.
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (rotated == 0)
+        std::cerr << "Nothing rotated\n";
+    return ms / (repeats * images.size());
+}
+
+// Milliseconds per 45 degree rotation of img split into threads row tiles, on the calling thread
+// and threads - 1 pool threads.
+double time_tiles(const Mat& img, size_t threads)
+{
+    CpuPool pool(threads - 1, 0, 0);
+    ParallelFor parallel_for = [&](size_t parts, const std::function<void(size_t)>& part) { pool.parallel_for(parts, part); };
+    auto start = std::chrono::steady_clock::now();
+    int n = 0;
+    do
+    {
+        if (rotate_image(img, 45, parallel_for, threads).empty())
+            std::cerr << "Nothing rotated\n";
+        n++;
+    } while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(500));
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / n;
+}
+
+void compare_tiles(size_t max_threads)
+{
+    Mat original = imread(IMAGE_DIR "/000.jpg", IMREAD_COLOR);
+    if (original.empty())
+    {
+        std::cerr << "Could not read " << IMAGE_DIR << "/000.jpg\n";
+        return;
+    }
+    setNumThreads(1); // as in the server: only the tiles run in parallel.
+    std::cout << "size";
+    for (size_t threads = 1; threads <= max_threads; threads++)
+        std::cout << "\t" << threads << " threads (ms)";
+    std::cout << "\n";
+    for (int side = 256; side <= 4096; side *= 2)
+    {
+        Mat img;
+        resize(original, img, Size(side, side));
+        std::cout << side << "x" << side;
+        for (size_t threads = 1; threads <= max_threads; threads++)
+            std::cout << "\t" << time_tiles(img, threads);
+        std::cout << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc == 3 && std::string(argv[1]) == "tiles")
+    {
+        compare_tiles(std::max(std::stoi(argv[2]), 1));
+        return 0;
+    }
+    int repeats = argc > 1 ? std::stoi(argv[1]) : 3;
+
+    std::vector<Mat> images;
+    std::vector<std::string> files; // the encoded images.
+    double megapixels = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(IMAGE_DIR))
+    {
+        Mat img = imread(entry.path().string(), IMREAD_COLOR);
+        if (img.empty())
+            continue;
+        megapixels += img.total() / 1e6;
+        images.push_back(img);
+        std::ifstream f(entry.path(), std::ios::binary);
+        std::stringstream content;
+        content << f.rdbuf();
+        files.push_back(content.str());
+    }
+    if (images.empty())
+    {
+        std::cerr << "No images found in " << IMAGE_DIR << "\n";
+        return 1;
+    }
+    std::cout << images.size() << " images, " << megapixels / images.size() << " megapixels on average\n";
+
+    std::cout << "angle\twarpAffine (ms/image)\tcv::rotate (ms/image)\trotate_image (ms/image)\n";
+    for (int angle : {90, 180, 270})
+    {
+        double w = run(images, angle, repeats, warp_rotate);
+        double c = run(images, angle, repeats, cv_rotate);
+        double r = run(images, angle, repeats, [](const Mat& img, int angle) { return rotate_image(img, angle); });
+        std::cout << angle << "\t" << w << "\t" << c << "\t" << r << std::endl;
+    }
+
+    auto decode_rotate_encode = [](const std::string& file, int angle) {
+        Mat buffer(1, (int)file.size(), CV_8UC1, (void*)file.data());
+        std::vector<uchar> out;
+        imencode(".jpg", rotate_image(imdecode(buffer, IMREAD_COLOR), angle), out);
+        return out;
+    };
+    auto codec_rotate = [](const std::string& file, int angle) {
+        thread_local Mat img; // as in the server.
+        std::string out;
+        if (decode_jpeg(file.data(), file.size(), img))
+            encode_jpeg(rotate_image(img, angle), 95, out);
+        return out;
+    };
+    size_t lossless = 0;
+    auto rotate_lossless = [&](const std::string& file, int angle) {
+        std::string out;
+        lossless += rotate_jpeg(file.data(), file.size(), angle, out);
+        return out;
+    };
+    std::cout << "angle\timdecode+rotate+imencode (ms/image)\tjpeg_codec (ms/image)\trotate_jpeg (ms/image)\n";
+    for (int angle : {90, 180, 270})
+    {
+        double d = run(files, angle, repeats, decode_rotate_encode);
+        double c = run(files, angle, repeats, codec_rotate);
+        double l = run(files, angle, repeats, rotate_lossless);
+        std::cout << angle << "\t" << d << "\t" << c << "\t" << l << std::endl;
+    }
+    std::cout << lossless << " of " << 3 * repeats * files.size()
+              << " rotate_jpeg calls were lossless, the others would take the decoding path\n";
+}
@@ -1,17 +1,55 @@
 // Use cqlsh if u want to run apache_cassandra on shell. 
-#include <cassandra.h>
 #include <iostream>
 #include <fstream>
 #include "include/httplib.h"
+#include "include/options.h"
+#include "include/bitcask_engine.h"
+#include "include/key_filter.h"
+#include "include/event_server.h"
+#ifndef NO_CASSANDRA // build without the Cassandra driver (make database-bitcask), only --engine=bitcask is then available.
+#include "include/cassandra_engine.h"
+#endif
 #include <sched.h>
 #include <csignal>
 #include <fstream>
 #include <unistd.h>
 #include <sys/sysinfo.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #define DB_IP "127.0.0.1"
 #define DB_port 5001
 #define CPU_core_id 1 // used to pin the process to core. used for load testing.
+#define KEEP_ALIVE_MAX_COUNT 100000 // requests served on one connection before it is closed.
+#define KEEP_ALIVE_TIMEOUT_SEC 60 // idle time after which a connection is closed.
+#define ENGINE "cassandra" // default for --engine, cassandra or bitcask.
+#define BITCASK_DIR "bitcask_data" // default for --bitcask-dir, where the bitcask engine keeps its files.
+#define BITCASK_MAX_FILE_BYTES (256UL << 20) // default for --bitcask-max-file-bytes, size at which a new data file is started.
+#define BITCASK_COMPACTION_RATIO 0.5 // default for --bitcask-compaction-ratio, share of dead bytes at which a file is compacted (0: never).
+#define BITCASK_COMPACTION_MB_PER_SEC 64 // default for --bitcask-compaction-mb-per-sec, I/O budget of the compactor (0: unlimited).
+#define BITCASK_DURABILITY "async" // default for --bitcask-durability: async (page cache), group (group commit) or fsync (every write).
+#define BITCASK_GROUP_COMMIT_US 200 // default for --bitcask-group-commit-us, how long a group commit waits for more writes to share its sync.
+#define KEY_FILTER_KEYS 1000000 // default for --key-filter-keys, keys the filter of stored keys is sized for. 0 disables it.
+#define KEY_FILTER_FP_RATE 0.01 // default for --key-filter-fp-rate, false positive rate of the key filter at that size.
+#define KEY_FILTER_REBUILD_FRACTION 0.25 // the key filter is rebuilt once deletes reach this share of its keys.
+#define IO_BACKEND "uring" // default for --io, disk I/O of the bitcask engine: uring (threads if unavailable) or threads.
+#define IO_QUEUE_DEPTH 256 // default for --io-queue-depth, operations in the io_uring at once. As many as DB_THREADS can issue.
+#define IO_BUFFERS 64 // default for --io-buffers, registered read buffers.
+#define IO_BUFFER_BYTES (256UL << 10) // default for --io-buffer-bytes. Larger values are read into ordinary buffers.
+#define IO_THREADS 64 // default for --io-threads, threads doing disk I/O when io_uring is not used.
+#define FRONT_END "events" // default for --front-end with the cassandra engine: events (one thread, driver callbacks finish the requests) or threads. bitcask always uses threads.
+// httplib worker threads of the threads front end. A request holds its thread until the engine has
+// answered, so this (not the number of cores) bounds the number of requests in flight. Waiting
+// threads cost no CPU.
+#define DB_THREADS 256
+#define WRITE_BATCH_WINDOW_US 0 // default for --write-batch-window-us, how long a write waits for others to batch with. 0 disables batching.
+#define WRITE_BATCH_MAX_STATEMENTS 32 // default for --write-batch-max-statements.
+#define WRITE_BATCH_MAX_BYTES 40960 // default for --write-batch-max-bytes. Must be below batch_size_fail_threshold_in_kb of Cassandra.
+#define CHUNK_BYTES 0 // default for --chunk-bytes. Images larger than this are stored in chunks of this size. 0 keeps every image inline.
 
 
 struct CpuTimes {
@@ -29,7 +67,7 @@ unsigned long readIOTime() {
 CpuTimes readCPU() {
     std::ifstream file("/proc/stat");
     std::string label;
-    CpuTimes t = {0};
+    CpuTimes t = {};
 
     std::string target = "cpu" + std::to_string(CPU_core_id);
 
@@ -91,12 +129,51 @@ void printStats() {
     unsigned long total = readMemKB("MemTotal");
     unsigned long avail = readMemKB("MemAvailable");
 
-    std::cout << "Percentage RAM used: " << (double)(total - avail) / total * 100.0<< "%\n\n";
+    std::cout << "Percentage RAM used: " << (double)(total - avail) / total * 100.0<< "%\n";
 }
 
 
-int main()
+// Puts a handler's answer into an httplib response. Parts are sent straight out of the engine's
+// buffers instead of being copied into the response; the provider keeps them alive until then.
+void set_response(EventServer::Answer answer, httplib::Response& res)
+{
+    res.status = answer.status;
+    if (answer.parts.empty())
+    {
+        if (!answer.body.empty())
+            res.set_content(answer.body, answer.content_type);
+        return;
+    }
+    size_t total = 0;
+    for (auto& part : answer.parts)
+        total += part.size;
+    res.set_content_provider(total, answer.content_type,
+        [parts = std::move(answer.parts)](size_t offset, size_t length, httplib::DataSink& sink) {
+            size_t start = 0;
+            for (auto& part : parts)
+            {
+                if (offset < start + part.size)
+                {
+                    size_t from = offset - start;
+                    size_t n = std::min(part.size - from, length);
+                    if (!sink.write(part.data + from, n))
+                        return false;
+                    offset += n;
+                    length -= n;
+                    if (length == 0)
+                        break;
+                }
+                start += part.size;
+            }
+            return true;
+        });
+}
+
+
+int main(int argc, char* argv[])
 {   
+    Options opts(argc, argv);
+
     cpu_set_t cpuset;
     CPU_ZERO(&cpuset);          // Clear the CPU set
     CPU_SET(CPU_core_id, &cpuset);  // Add core_id to the set
@@ -111,130 +188,216 @@ int main()
 
     std::cout << "Pinned database process " << pid << " to CPU core " << CPU_core_id << std::endl;
 
-    httplib::Server db_svr; // used to communicate between server and database
+    std::unique_ptr<StorageEngine> engine;
+    std::string engine_name = opts.get("engine", std::string(ENGINE));
+    if (engine_name == "bitcask")
+    {
+        BitcaskEngine::Durability durability;
+        std::string durability_name = opts.get("bitcask-durability", std::string(BITCASK_DURABILITY));
+        if (!BitcaskEngine::parse_durability(durability_name, durability))
+        {
+            std::cerr << "Unknown durability " << durability_name << ", expected async, group or fsync\n";
+            return 1;
+        }
+        engine.reset(new BitcaskEngine(opts.get("bitcask-dir", std::string(BITCASK_DIR)),
+                                       opts.get("bitcask-max-file-bytes", (size_t)BITCASK_MAX_FILE_BYTES),
+                                       opts.get("bitcask-compaction-ratio", (double)BITCASK_COMPACTION_RATIO),
+                                       opts.get("bitcask-compaction-mb-per-sec", (size_t)BITCASK_COMPACTION_MB_PER_SEC) << 20,
+                                       durability,
+                                       std::chrono::microseconds(opts.get("bitcask-group-commit-us", (size_t)BITCASK_GROUP_COMMIT_US)),
+                                       std::unique_ptr<DiskIO>(new DiskIO(opts.get("io", std::string(IO_BACKEND)) == "uring",
+                                                                          opts.get("io-queue-depth", (size_t)IO_QUEUE_DEPTH),
+                                                                          opts.get("io-buffers", (size_t)IO_BUFFERS),
+                                                                          opts.get("io-buffer-bytes", (size_t)IO_BUFFER_BYTES),
+                                                                          opts.get("io-threads", (size_t)IO_THREADS)))));
+    }
+#ifndef NO_CASSANDRA
+    else if (engine_name == "cassandra")
+    {
+        engine.reset(new CassandraEngine(DB_IP, opts.get("chunk-bytes", (size_t)CHUNK_BYTES),
+                                         std::chrono::microseconds(opts.get("write-batch-window-us", (size_t)WRITE_BATCH_WINDOW_US)),
+                                         opts.get("write-batch-max-statements", (size_t)WRITE_BATCH_MAX_STATEMENTS),
+                                         opts.get("write-batch-max-bytes", (size_t)WRITE_BATCH_MAX_BYTES)));
+    }
+#endif
+    else
+    {
+        std::cerr << "Unknown or unavailable storage engine " << engine_name << "\n";
+        return 1;
+    }
 
-    // 1. Connect to Cassandra
-    CassCluster* cluster = cass_cluster_new();
-    cass_cluster_set_contact_points(cluster, DB_IP);
-
-    CassSession* session = cass_session_new();
-    CassFuture* connect_future = cass_session_connect(session, cluster);
-    cass_future_wait(connect_future);
-    cass_future_free(connect_future);
-
-    // 2. Create keyspace
-    const char* create_keyspace =
-        "CREATE KEYSPACE IF NOT EXISTS IMAGE_STORE "
-        "WITH replication = {'class': 'SimpleStrategy', 'replication_factor': 1};";
-    CassStatement* stmt = cass_statement_new(create_keyspace, 0);
-    CassFuture* future = cass_session_execute(session, stmt);
-    cass_future_wait(future);
-    cass_statement_free(stmt);
-    cass_future_free(future);
-
-    // 3. Use keyspace
-    stmt = cass_statement_new("USE IMAGE_STORE;", 0);
-    future = cass_session_execute(session, stmt);
-    cass_future_wait(future);
-    cass_statement_free(stmt);
-    cass_future_free(future);
-
-    // 4. Create table
-    const char* create_table =
-        "CREATE TABLE IF NOT EXISTS image_store ("
-        "image_id text PRIMARY KEY, " 
-        "image_data BLOB);";
-    stmt = cass_statement_new(create_table, 0);
-    future = cass_session_execute(session, stmt);
-    cass_future_wait(future);
-    cass_statement_free(stmt);
-    cass_future_free(future);
-
-    const char* query;
-    std::string key, img;
-    db_svr.Post("/create", [&](const httplib::Request& req, httplib::Response& res){
+    // Filter of the stored keys: reads and deletes of keys it does not contain are answered without
+    // the engine. Built by scanning all keys, so this can take a while with many images.
+    KeyFilter key_filter(opts.get("key-filter-keys", (size_t)KEY_FILTER_KEYS),
+                         opts.get("key-filter-fp-rate", (double)KEY_FILTER_FP_RATE), KEY_FILTER_REBUILD_FRACTION,
+                         [&](const std::function<void(const std::string&)>& fn) { return engine->for_each_key(fn); });
+
+    // The handlers answer through respond, on whichever thread has the answer: with the Cassandra
+    // engine, the driver's callback of the last query. They run concurrently; the engine is
+    // thread-safe.
+    using Answer = EventServer::Answer;
+    using Respond = EventServer::Respond;
+    std::vector<std::pair<std::string, EventServer::Handler>> gets, posts;
+    gets.reserve(3); // growing them from empty gets a false -Warray-bounds from g++ 12 at -O2.
+    posts.reserve(3);
+
+    posts.emplace_back("/create", [&](const httplib::Request& req, Respond respond){
         auto it = req.form.files.find("file");
-        const auto& file = it->second;
-
-        key = file.filename;
-        img = file.content;
-
-        query =
-        "INSERT INTO image_store (image_id, image_data) "
-        "VALUES (?, ?);";
-
-        stmt = cass_statement_new(query, 2);
-        cass_statement_bind_string(stmt, 0, key.c_str());
-        cass_statement_bind_bytes(stmt, 1, reinterpret_cast<const cass_byte_t*>(img.data()), img.size());
-
-        future = cass_session_execute(session, stmt);
-        cass_future_wait(future);
-
-        if (cass_future_error_code(future) == CASS_OK)
-        {    //std::cout << "Image " << key << " stored successfully.\n";
-        }
-        else
-            std::cerr << "Insert " << key << " failed.\n";
+        if (it == req.form.files.end())
+            return respond({400});
+        const httplib::FormData* file = &it->second;
+
+        key_filter.lock(file->filename, [&, file, respond](KeyFilter::WriteLock lock){
+            key_filter.add(file->filename);
+            engine->put_async(file->filename, file->content, [file, lock, respond](StorageEngine::Status status){
+                if (status == StorageEngine::OK)
+                {    //std::cout << "Image " << file->filename << " stored successfully.\n";
+                    respond({});
+                }
+                else
+                {
+                    std::cerr << "Insert " << file->filename << " failed.\n";
+                    respond({500});
+                }
+            });
+        });
+    });
 
-        cass_statement_free(stmt);
-        cass_future_free(future);
+    // Stores the image only if the key does not exist yet, in one round trip.
+    // Answers "Created" or "Key already present"; the old image is never read.
+    // If the key filter says the key does not exist, it is stored with a plain insert instead of a
+    // conditional one (a lightweight transaction in Cassandra). That relies on this process being
+    // the only writer of the store: other writes of the key wait for the key's lock.
+    posts.emplace_back("/create_if_absent", [&](const httplib::Request& req, Respond respond){
+        auto it = req.form.files.find("file");
+        if (it == req.form.files.end())
+            return respond({400});
+        const httplib::FormData* file = &it->second;
+
+        key_filter.lock(file->filename, [&, file, respond](KeyFilter::WriteLock lock){
+            bool absent = !key_filter.may_contain(file->filename);
+            key_filter.add(file->filename);
+            auto done = [file, lock, respond](StorageEngine::Status status){
+                if (status == StorageEngine::FAILED)
+                {
+                    std::cerr << "Insert " << file->filename << " failed.\n";
+                    respond({500});
+                }
+                else
+                    respond({200, "text/plain", status == StorageEngine::OK ? "Created" : "Key already present"});
+            };
+            if (absent)
+                engine->put_async(file->filename, file->content, done);
+            else
+                engine->put_if_absent_async(file->filename, file->content, done);
+        });
     });
 
-    db_svr.Get("/read", [&](const httplib::Request& req, httplib::Response& res){
+    gets.emplace_back("/read", [&](const httplib::Request& req, Respond respond){
         std::string key = req.get_param_value("key");
-        std::string value;
-        query = "SELECT image_data from image_store where image_id=?;";
-        stmt = cass_statement_new(query, 1);
-        cass_statement_bind_string(stmt, 0, key.c_str());
-        future = cass_session_execute(session, stmt);
-        cass_future_wait(future);
-
-        if (cass_future_error_code(future) != CASS_OK)
-            std::cerr << "Read failed.\n";
-        
-        const CassResult* result = cass_future_get_result(future);
-        if (result != nullptr && cass_result_row_count(result) > 0)
-        {
-            // Get first (and only) row
-            const CassRow* row = cass_result_first_row(result);
-            const CassValue* img_val = cass_row_get_column_by_name(row, "image_data");
-
-            // get the image data as bytes
-            const cass_byte_t* img_bytes;
-            size_t img_size;
-            cass_value_get_bytes(img_val, &img_bytes, &img_size);
-
-            std::string img_data(reinterpret_cast<const char*>(img_bytes), img_size); // send this
-            res.set_content(img_data, "image/jpeg");
-        }
-        if (result != nullptr && cass_result_row_count(result) == 0)
-        {
-            res.set_content("Key does not exist.", "text/plain");
-        }
+        if (!key_filter.may_contain(key))
+            return respond({200, "text/plain", "Key does not exist."});
+        engine->get_async(key, [&, respond](StorageEngine::Status status, std::vector<Blob> parts){
+            if (status == StorageEngine::FAILED)
+            {
+                std::cerr << "Read failed.\n";
+                return respond({500});
+            }
+            if (status == StorageEngine::NOT_FOUND)
+            {
+                key_filter.false_positive();
+                return respond({200, "text/plain", "Key does not exist."});
+            }
+            // The image is sent straight out of the engine's buffers (e.g. the Cassandra driver's result).
+            respond({200, "image/jpeg", "", std::move(parts)});
+        });
     });
-    
-    db_svr.Post("/delete", [&](const httplib::Request& req, httplib::Response& res){
+
+    posts.emplace_back("/delete", [&](const httplib::Request& req, Respond respond){
         std::string key = req.get_param_value("key");
-        query = "DELETE FROM image_store WHERE image_id = ?;";
-        stmt = cass_statement_new(query, 1);
-        cass_statement_bind_string(stmt, 0, key.c_str());
-        future = cass_session_execute(session, stmt);
-        cass_future_wait(future);
-        if (cass_future_error_code(future) == CASS_OK)
-        {   //std::cout << "Image " << key<< " deleted successfully.\n"; 
-        }
-        else
-            std::cerr << "Delete failed.\n";
-        cass_statement_free(stmt);
-        cass_future_free(future);
+        if (!key_filter.may_contain(key))
+            return respond({});
+        key_filter.lock(key, [&, key, respond](KeyFilter::WriteLock lock){
+            engine->erase_async(key, [&, lock, respond](StorageEngine::Status status){
+                if (status == StorageEngine::OK)
+                {   //std::cout << "Image " << key<< " deleted successfully.\n";
+                    key_filter.erased();
+                    respond({});
+                }
+                else
+                {
+                    std::cerr << "Delete failed.\n";
+                    respond({500});
+                }
+            });
+        });
     });
-    
-    db_svr.Get("/printStatistics", [&](const httplib::Request& req, httplib::Response& res){
+
+    // Used by the server's connection pool to check idle connections.
+    gets.emplace_back("/health", [&](const httplib::Request&, Respond respond){
+        respond({200, "text/plain", "OK"});
+    });
+
+    gets.emplace_back("/printStatistics", [&](const httplib::Request&, Respond respond){
         printStats();
+        engine->print_stats(std::cout);
+        KeyFilter::Stats kf = key_filter.stats();
+        std::cout << "Key filter: " << kf.checks << " lookups, " << kf.definite_misses << " answered without storage, "
+                  << kf.false_positives << " false positives (rate "
+                  << (kf.false_positives ? (double)kf.false_positives / (kf.false_positives + kf.definite_misses) : 0)
+                  << ", estimated " << kf.estimated_fp_rate << "), " << kf.bits << " bits, " << kf.hashes << " hashes, "
+                  << kf.keys << " keys at the last build, " << kf.rebuilds << " rebuilds\n";
+        std::cout << "\n";
         t1 = readIOTime();
         c1 = readCPU();
+        respond({});
     });
 
-    db_svr.listen(DB_IP, DB_port); // start listening.
+    std::string front_end = opts.get("front-end", std::string(engine->asynchronous() ? FRONT_END : "threads"));
+    if (front_end == "events" && engine->asynchronous())
+    {
+        // One thread serves every connection; the engine's callbacks finish the requests.
+        EventServer event_svr;
+        for (auto& route : gets)
+            event_svr.Get(route.first, route.second);
+        for (auto& route : posts)
+            event_svr.Post(route.first, route.second);
+        if (!event_svr.listen(DB_IP, DB_port)) // start listening.
+        {
+            std::cerr << "Could not listen on " << DB_IP << ":" << DB_port << "\n";
+            return 2;
+        }
+        return 0;
+    }
+    if (front_end != "threads")
+    {
+        std::cerr << "Unknown front end " << front_end << ", expected threads, or events with the cassandra engine\n";
+        return 1;
+    }
 
+    // httplib's worker threads, each waiting for the answer of its request.
+    httplib::Server db_svr; // used to communicate between server and database
+    auto wait_for = [](EventServer::Handler handler) {
+        return [handler](const httplib::Request& req, httplib::Response& res) {
+            auto answered = std::make_shared<std::promise<Answer>>();
+            handler(req, [answered](Answer answer) { answered->set_value(std::move(answer)); });
+            set_response(answered->get_future().get(), res);
+        };
+    };
+    for (auto& route : gets)
+        db_svr.Get(route.first, wait_for(route.second));
+    for (auto& route : posts)
+        db_svr.Post(route.first, wait_for(route.second));
+
+    // The server keeps a pool of keep-alive connections open to the database, so do not close them
+    // after a few requests or a few seconds of inactivity.
+    db_svr.set_keep_alive_max_count(KEEP_ALIVE_MAX_COUNT);
+    db_svr.set_keep_alive_timeout(KEEP_ALIVE_TIMEOUT_SEC);
+    db_svr.new_task_queue = [] { return new httplib::ThreadPool(DB_THREADS); };
+
+    if (!db_svr.listen(DB_IP, DB_port)) // start listening.
+    {
+        std::cerr << "Could not listen on " << DB_IP << ":" << DB_port << "\n";
+        return 2;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,821 @@
+// Embedded log-structured storage engine in the style of Bitcask, so the database can run without
+// Cassandra (e.g. for benchmarks on any Linux machine): ./database --engine=bitcask
+//
+// Values are only ever appended to data files in one directory (00000001.data, 00000002.data,
+// ...). An in-memory hash index maps every live key to the file, offset and size of its latest
+// value, so a write is one sequential append and a read is one pread. Deleting a key appends a
+// tombstone. The last file is the active one; once it grows past max_file_bytes a new one is
+// started. Older files are only ever replaced as a whole by the compactor.
+//
+// Record: crc32 (4 bytes) | key size (4) | value size (4, TOMBSTONE for a delete) | key | value.
+// The integers are in native (little endian) order and the crc covers everything after it.
+//
+// Compaction: a background thread picks the older file with the largest share of dead bytes
+// (overwritten or deleted values), once that share reaches compaction_ratio, and copies
+// its live records to a new file. The new file keeps the id of the old one, so files are still
+// replayed in the order they were written. Copying is throttled to compaction_bytes_per_sec (read
+// plus written) and runs without any lock; only the swap at the end takes index_m, to point the
+// keys that were not written again in the meantime at their new offsets. Readers that still hold
+// the old file keep its descriptor open until they are done.
+//
+// Hint files: next to every older data file the compactor writes NNNNNNNN.hint, the index entries
+// of that file (key, value size, value offset) followed by the size of the data file and a crc.
+// On startup a file whose hint is valid is loaded from it instead of reading all of its values;
+// other files are scanned. A record that is cut off or fails its checksum (a crash in the middle of
+// an append) ends the scan of its file, and is cut off if it is in the active file.
+//
+// Reads of values, appends and syncs go through io (disk_io.h, io_uring when available); a value
+// that fits is read into one of its registered buffers and sent from there. Scans at startup, the
+// compactor's copying and hint files use plain system calls.
+//
+// Durability, chosen at startup: ASYNC replies once a write is in the page cache, so the latest
+// writes can be lost if the machine, not just the process, goes down. FSYNC syncs the data file
+// after every write before replying, one write at a time. GROUP (group commit) replies after a
+// sync too, but writes that arrive while a sync is running, or within group_commit_window of the
+// first of them, share the next one. Compacted files and hints are always synced before they
+// replace the old ones.
+#pragma once
+
+#include "disk_io.h"
+#include "storage_engine.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class BitcaskEngine : public StorageEngine
+{
+public:
+    enum Durability { ASYNC, GROUP, FSYNC };
+
+    // Parses async, group or fsync.
+    static bool parse_durability(const std::string& name, Durability& durability)
+    {
+        static const std::pair<const char*, Durability> names[] = {{"async", ASYNC}, {"group", GROUP}, {"fsync", FSYNC}};
+        for (auto& n : names)
+            if (name == n.first)
+            {
+                durability = n.second;
+                return true;
+            }
+        return false;
+    }
+
+    // compaction_ratio 0 turns compaction off, compaction_bytes_per_sec 0 does not throttle it.
+    BitcaskEngine(const std::string& dir, size_t max_file_bytes, double compaction_ratio, size_t compaction_bytes_per_sec,
+                  Durability durability, std::chrono::microseconds group_commit_window, std::unique_ptr<DiskIO> io)
+        : dir(dir), max_file_bytes(max_file_bytes), compaction_ratio(compaction_ratio),
+          compaction_bytes_per_sec(compaction_bytes_per_sec), durability(durability),
+          group_commit_window(group_commit_window), io(std::move(io))
+    {
+        if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+            fail("Could not create " + dir);
+
+        std::vector<uint32_t> ids;
+        if (DIR* d = opendir(dir.c_str()))
+        {
+            while (dirent* entry = readdir(d))
+            {
+                std::string name = entry->d_name;
+                if (name.size() > 8 && name.compare(name.size() - 8, 8, ".compact") == 0)
+                    unlink((dir + "/" + name).c_str()); // left over by a compaction that did not finish.
+                else if (name.size() > 5 && isdigit((unsigned char)name[0]) && name.compare(name.size() - 5, 5, ".data") == 0)
+                    ids.push_back(std::stoul(name));
+            }
+            closedir(d);
+        }
+        std::sort(ids.begin(), ids.end());
+
+        size_t hinted = 0;
+        for (uint32_t id : ids)
+        {
+            auto file = open_file(id);
+            if (id == ids.back())
+                active_entries = scan(file, true);
+            else if (load_hint(file))
+                hinted++;
+            else
+                hints.push_back({file, scan(file, false)});
+        }
+        if (ids.empty())
+            open_file(1);
+        active = files.rbegin()->second;
+        std::cout << "Bitcask engine: " << index.size() << " keys in " << files.size() << " files (" << hinted
+                  << " loaded from hints) in " << dir << ", disk I/O: " << this->io->backend() << std::endl;
+
+        compactor = std::thread([this] { run_compactor(); });
+    }
+
+    BitcaskEngine(const BitcaskEngine&) = delete;
+    BitcaskEngine& operator=(const BitcaskEngine&) = delete;
+
+    // Stops the compactor. A compaction in progress is abandoned and its output removed.
+    ~BitcaskEngine()
+    {
+        {
+            std::lock_guard<std::mutex> lock(compactor_m);
+            stopping = true;
+        }
+        compactor_cv.notify_all();
+        compactor.join();
+    }
+
+    Status put(const std::string& key, const std::string& value) override { return write(key, &value, false); }
+
+    Status put_if_absent(const std::string& key, const std::string& value) override { return write(key, &value, true); }
+
+    // One read into a buffer of its own (a registered one if one is free and large enough), which
+    // the returned piece keeps alive.
+    Status get(const std::string& key, std::vector<Blob>& value) override
+    {
+        Location loc;
+        std::shared_ptr<DataFile> file;
+        {
+            std::shared_lock<std::shared_mutex> lock(index_m);
+            auto it = index.find(key);
+            if (it == index.end())
+                return NOT_FOUND;
+            loc = it->second;
+            file = files.at(loc.file_id);
+        }
+
+        std::shared_ptr<char> registered = io->buffer(loc.size);
+        std::shared_ptr<std::string> own;
+        char* buffer = registered.get();
+        if (!buffer)
+        {
+            own = std::make_shared<std::string>(loc.size, '\0');
+            buffer = &(*own)[0];
+        }
+        if (!io->read_all(file->fd, buffer, loc.size, loc.offset))
+        {
+            std::cerr << "Could not read " << key << " from " << file->path << ": " << strerror(errno) << "\n";
+            return FAILED;
+        }
+        value.push_back({buffer, loc.size, registered ? std::shared_ptr<const void>(registered) : own});
+        return OK;
+    }
+
+    Status erase(const std::string& key) override { return write(key, nullptr, false); }
+
+    bool for_each_key(const std::function<void(const std::string&)>& fn) override
+    {
+        std::shared_lock<std::shared_mutex> lock(index_m);
+        for (auto& entry : index)
+            fn(entry.first);
+        return true;
+    }
+
+    // Space amplification is bytes on disk per live byte, write amplification bytes written (by
+    // requests and by the compactor) per byte written by requests.
+    void print_stats(std::ostream& out) override
+    {
+        std::shared_lock<std::shared_mutex> lock(index_m);
+        uint64_t total = 0, dead = 0;
+        for (auto& f : files)
+        {
+            total += f.second->size;
+            dead += f.second->dead;
+        }
+        uint64_t live = total - dead, written = foreground_bytes + compacted_bytes;
+        out << "Bitcask keys: " << index.size() << ", files: " << files.size() << ", bytes: " << total
+            << ", live bytes: " << live << "\n";
+        out << "Bitcask space amplification: " << (live ? (double)total / live : 0)
+            << ", write amplification: " << (foreground_bytes ? (double)written / foreground_bytes : 0) << "\n";
+        out << "Bitcask compactions: " << compactions << ", bytes reclaimed: " << reclaimed_bytes
+            << ", bytes copied: " << compacted_bytes << "\n";
+        if (durability == GROUP)
+        {
+            std::lock_guard<std::mutex> sync_lock(sync_m);
+            out << "Bitcask group commits: " << group_syncs << ", writes per sync: "
+                << (group_syncs ? (double)group_synced_writes / group_syncs : 0) << "\n";
+        }
+        DiskIO::Stats st = io->stats();
+        out << "Disk I/O (" << io->backend() << "): operations: " << st.ops << ", submit calls: " << st.submits
+            << ", largest batch: " << st.max_batch << ", fixed buffer reads: " << st.fixed_reads
+            << ", no free buffer: " << st.buffer_misses << "\n";
+    }
+
+private:
+    static const uint32_t TOMBSTONE = 0xffffffff;
+    static const size_t HEADER_BYTES = 12;
+    static const size_t HINT_HEADER_BYTES = 16; // key size (4) | value size (4) | value offset (8)
+    static const size_t HINT_TRAILER_BYTES = 12; // data file size (8) | crc32 of everything before (4)
+
+    struct DataFile
+    {
+        uint32_t id;
+        std::string path;
+        int fd;
+        uint64_t size; // bytes of valid records. Only changed by the writer.
+        uint64_t dead = 0; // bytes of overwritten or deleted values. Guarded by index_m.
+        uint64_t tombstones = 0; // bytes of tombstones. Guarded by index_m.
+        ~DataFile() { close(fd); }
+    };
+
+    struct Location
+    {
+        uint32_t file_id;
+        uint32_t size; // of the value.
+        uint64_t offset; // of the value.
+    };
+
+    // What a hint file records of one record.
+    struct HintEntry
+    {
+        std::string key;
+        uint32_t value_size; // TOMBSTONE for a delete.
+        uint64_t value_offset;
+    };
+
+    static uint64_t record_bytes(size_t key_size, size_t value_size) { return HEADER_BYTES + key_size + value_size; }
+
+    [[noreturn]] static void fail(const std::string& what)
+    {
+        std::cerr << what << ": " << strerror(errno) << "\n";
+        exit(1);
+    }
+
+    static uint32_t crc32(const char* data, size_t n, uint32_t crc = 0)
+    {
+        static const std::vector<uint32_t> table = [] {
+            std::vector<uint32_t> t(256);
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                t[i] = c;
+            }
+            return t;
+        }();
+        crc = ~crc;
+        for (size_t i = 0; i < n; i++)
+            crc = table[(crc ^ (uint8_t)data[i]) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    static bool read_at(int fd, char* buf, size_t n, uint64_t offset)
+    {
+        while (n > 0)
+        {
+            ssize_t r = pread(fd, buf, n, offset);
+            if (r <= 0)
+            {
+                if (r < 0 && errno == EINTR)
+                    continue;
+                return false;
+            }
+            buf += r;
+            n -= r;
+            offset += r;
+        }
+        return true;
+    }
+
+    static bool write_at(int fd, const char* buf, size_t n, uint64_t offset)
+    {
+        while (n > 0)
+        {
+            ssize_t w = pwrite(fd, buf, n, offset);
+            if (w < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            buf += w;
+            n -= w;
+            offset += w;
+        }
+        return true;
+    }
+
+    std::string hint_path(uint32_t id) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/%08u.hint", id);
+        return dir + name;
+    }
+
+    // Whether key has a value. Called by writers holding write_m.
+    bool contains(const std::string& key)
+    {
+        std::shared_lock<std::shared_mutex> lock(index_m);
+        return index.count(key) != 0;
+    }
+
+    // Called from the constructor, or by the writer holding write_m.
+    std::shared_ptr<DataFile> open_file(uint32_t id)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/%08u.data", id);
+        auto file = std::make_shared<DataFile>();
+        file->id = id;
+        file->path = dir + name;
+        file->fd = open(file->path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (file->fd < 0)
+            fail("Could not open " + file->path);
+        file->size = 0;
+        std::unique_lock<std::shared_mutex> lock(index_m);
+        files[id] = file;
+        return file;
+    }
+
+    // Applies a record of file, of n bytes, to the index (only called from the constructor).
+    void replay(DataFile& file, const HintEntry& entry, uint64_t n)
+    {
+        auto it = index.find(entry.key);
+        if (it != index.end())
+            files.at(it->second.file_id)->dead += record_bytes(entry.key.size(), it->second.size);
+        if (entry.value_size == TOMBSTONE)
+        {
+            if (it != index.end())
+                index.erase(it);
+            file.tombstones += n;
+        }
+        else
+            index[entry.key] = {file.id, entry.value_size, entry.value_offset};
+    }
+
+    // Adds the records of file to the index and returns them (only called from the constructor).
+    std::vector<HintEntry> scan(const std::shared_ptr<DataFile>& file, bool is_active)
+    {
+        struct stat st;
+        fstat(file->fd, &st);
+        uint64_t offset = 0, end = st.st_size;
+        std::vector<HintEntry> entries;
+        std::string record;
+        while (offset + HEADER_BYTES <= end)
+        {
+            uint32_t header[3];
+            if (!read_at(file->fd, (char*)header, HEADER_BYTES, offset))
+                break;
+            uint64_t value_size = header[2] == TOMBSTONE ? 0 : header[2];
+            uint64_t n = record_bytes(header[1], value_size);
+            if (offset + n > end)
+                break;
+            record.resize(n);
+            if (!read_at(file->fd, &record[0], n, offset) || crc32(&record[4], n - 4) != header[0])
+                break;
+
+            entries.push_back({record.substr(HEADER_BYTES, header[1]), header[2], offset + HEADER_BYTES + header[1]});
+            replay(*file, entries.back(), n);
+            offset += n;
+        }
+
+        file->size = offset;
+        if (offset < end)
+        {
+            std::cerr << "Ignoring " << end - offset << " bytes of damaged records at the end of " << file->path << "\n";
+            if (is_active && ftruncate(file->fd, offset) != 0)
+                fail("Could not truncate " + file->path);
+        }
+        return entries;
+    }
+
+    // Adds the records of file to the index from its hint file, if that is complete and was written
+    // for the current contents of file (only called from the constructor).
+    bool load_hint(const std::shared_ptr<DataFile>& file)
+    {
+        int fd = open(hint_path(file->id).c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st, data_st;
+        std::string hint;
+        bool ok = fstat(fd, &st) == 0 && fstat(file->fd, &data_st) == 0 && st.st_size >= (off_t)HINT_TRAILER_BYTES;
+        if (ok)
+        {
+            hint.resize(st.st_size);
+            ok = read_at(fd, &hint[0], hint.size(), 0);
+        }
+        close(fd);
+        if (!ok)
+            return false;
+
+        size_t end = hint.size() - HINT_TRAILER_BYTES;
+        uint64_t data_size;
+        uint32_t crc;
+        memcpy(&data_size, &hint[end], 8);
+        memcpy(&crc, &hint[end + 8], 4);
+        if (crc32(hint.data(), end + 8) != crc || data_size != (uint64_t)data_st.st_size)
+            return false;
+
+        for (size_t pos = 0; pos + HINT_HEADER_BYTES <= end;)
+        {
+            uint32_t key_size;
+            HintEntry entry;
+            memcpy(&key_size, &hint[pos], 4);
+            memcpy(&entry.value_size, &hint[pos + 4], 4);
+            memcpy(&entry.value_offset, &hint[pos + 8], 8);
+            entry.key = hint.substr(pos + HINT_HEADER_BYTES, key_size);
+            pos += HINT_HEADER_BYTES + key_size;
+            replay(*file, entry, record_bytes(key_size, entry.value_size == TOMBSTONE ? 0 : entry.value_size));
+        }
+        file->size = data_size;
+        return true;
+    }
+
+    // Writes the hint file of a data file of data_size bytes to path, and syncs it.
+    static bool write_hint(const std::string& path, const std::vector<HintEntry>& entries, uint64_t data_size)
+    {
+        std::string hint;
+        for (auto& entry : entries)
+        {
+            uint32_t key_size = entry.key.size();
+            hint.append((const char*)&key_size, 4);
+            hint.append((const char*)&entry.value_size, 4);
+            hint.append((const char*)&entry.value_offset, 8);
+            hint += entry.key;
+        }
+        hint.append((const char*)&data_size, 8);
+        uint32_t crc = crc32(hint.data(), hint.size());
+        hint.append((const char*)&crc, 4);
+
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+        bool ok = write_at(fd, hint.data(), hint.size(), 0) && fdatasync(fd) == 0;
+        close(fd);
+        return ok;
+    }
+
+    // Sets key to *value, or deletes it if value is null (and it exists). With only_if_absent, does
+    // nothing and returns EXISTS if key exists. Returns once the write is as durable as configured.
+    Status write(const std::string& key, const std::string* value, bool only_if_absent)
+    {
+        uint64_t seq;
+        {
+            std::lock_guard<std::mutex> lock(write_m);
+            if (only_if_absent && contains(key))
+                return EXISTS;
+            if (!value && !contains(key))
+                return OK;
+            Status status = append(key, value);
+            if (status != OK || durability != GROUP)
+                return status;
+            seq = appended;
+        }
+        wait_for_sync(seq);
+        return OK;
+    }
+
+    // Group commit: waits until the write numbered seq is synced. The first writer that finds no
+    // sync running becomes the leader: it waits for the window, then syncs the active file (up to
+    // the last write at that moment) for every writer waiting, while the next writers queue up
+    // behind it.
+    void wait_for_sync(uint64_t seq)
+    {
+        std::unique_lock<std::mutex> lock(sync_m);
+        while (synced < seq)
+        {
+            if (syncing)
+            {
+                sync_cv.wait(lock);
+                continue;
+            }
+            syncing = true;
+            lock.unlock();
+            if (group_commit_window.count() > 0)
+                std::this_thread::sleep_for(group_commit_window);
+            std::shared_ptr<DataFile> file;
+            uint64_t target;
+            {
+                std::lock_guard<std::mutex> write_lock(write_m);
+                file = active;
+                target = appended;
+            }
+            // Files before the active one were synced when they were rolled.
+            sync_or_exit(*file);
+            lock.lock();
+            group_syncs++;
+            group_synced_writes += target - synced;
+            synced = target;
+            syncing = false;
+            sync_cv.notify_all();
+        }
+    }
+
+    // After a failed fsync the kernel may have dropped the dirty pages, so no retry can make the
+    // writes durable: stop instead of acknowledging them.
+    void sync_or_exit(const DataFile& file)
+    {
+        if (!io->sync(file.fd))
+            fail("Could not sync " + file.path);
+    }
+
+    // Appends a record setting key to *value, or deleting it if value is null, and updates the
+    // index. Called with write_m held.
+    Status append(const std::string& key, const std::string* value)
+    {
+        if (active->size >= max_file_bytes)
+        {
+            if (durability != ASYNC)
+                sync_or_exit(*active);
+            // The full file is never written again: hand its entries to the compactor for its hint.
+            {
+                std::lock_guard<std::mutex> lock(compactor_m);
+                hints.push_back({active, std::move(active_entries)});
+            }
+            compactor_cv.notify_one();
+            active_entries.clear();
+            active = open_file(active->id + 1);
+        }
+
+        uint32_t header[3];
+        header[1] = key.size();
+        header[2] = value ? value->size() : TOMBSTONE;
+        uint32_t crc = crc32((const char*)&header[1], 8);
+        crc = crc32(key.data(), key.size(), crc);
+        if (value)
+            crc = crc32(value->data(), value->size(), crc);
+        header[0] = crc;
+
+        iovec parts[3] = {
+            {header, HEADER_BYTES},
+            {(void*)key.data(), key.size()},
+            {(void*)(value ? value->data() : nullptr), value ? value->size() : 0},
+        };
+        uint64_t n = record_bytes(key.size(), value ? value->size() : 0);
+        if (!io->write_all(active->fd, parts, 3, active->size))
+        {
+            std::cerr << "Could not write " << key << " to " << active->path << ": " << strerror(errno) << "\n";
+            return FAILED;
+        }
+        if (durability == FSYNC)
+            sync_or_exit(*active);
+        uint64_t offset = active->size;
+        appended++;
+        foreground_bytes += n;
+        active_entries.push_back({key, header[2], offset + HEADER_BYTES + key.size()});
+
+        std::unique_lock<std::shared_mutex> lock(index_m);
+        active->size += n;
+        auto it = index.find(key);
+        if (it != index.end())
+            files.at(it->second.file_id)->dead += record_bytes(key.size(), it->second.size);
+        if (value)
+            index[key] = {active->id, (uint32_t)value->size(), offset + HEADER_BYTES + key.size()};
+        else
+        {
+            index.erase(key);
+            active->tombstones += n;
+        }
+        return OK;
+    }
+
+    // The compactor thread: writes the hints handed to it, and compacts one file at a time while
+    // some file is worth it. Looks again every second.
+    void run_compactor()
+    {
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(compactor_m);
+                compactor_cv.wait_for(lock, std::chrono::seconds(1), [&] { return stopping || !hints.empty(); });
+                if (stopping)
+                    return;
+            }
+            write_hints();
+            while (!is_stopping())
+            {
+                std::shared_ptr<DataFile> file = pick_file();
+                if (!file)
+                    break;
+                write_hints(); // the hint of a file that was just rolled, before it is compacted.
+                compact(file);
+            }
+        }
+    }
+
+    void write_hints()
+    {
+        std::deque<std::pair<std::shared_ptr<DataFile>, std::vector<HintEntry>>> todo;
+        {
+            std::lock_guard<std::mutex> lock(compactor_m);
+            todo.swap(hints);
+        }
+        for (auto& h : todo)
+            if (!write_hint(hint_path(h.first->id), h.second, h.first->size))
+                std::cerr << "Could not write " << hint_path(h.first->id) << ": " << strerror(errno) << "\n";
+    }
+
+    bool is_stopping()
+    {
+        std::lock_guard<std::mutex> lock(compactor_m);
+        return stopping;
+    }
+
+    // The older file with the largest share of dead bytes, if that reaches compaction_ratio. A
+    // tombstone is only dead in the oldest file: elsewhere an older file may still hold a value of
+    // its key.
+    std::shared_ptr<DataFile> pick_file()
+    {
+        if (compaction_ratio <= 0)
+            return nullptr;
+        std::shared_lock<std::shared_mutex> lock(index_m);
+        std::shared_ptr<DataFile> best;
+        double best_ratio = compaction_ratio;
+        for (auto it = files.begin(); it != files.end() && std::next(it) != files.end(); ++it) // not the active file.
+        {
+            const DataFile& f = *it->second;
+            uint64_t dead = f.dead + (it == files.begin() ? f.tombstones : 0);
+            double ratio = f.size ? (double)dead / f.size : 0;
+            if (f.size && ratio >= best_ratio)
+            {
+                best = it->second;
+                best_ratio = ratio;
+            }
+        }
+        return best;
+    }
+
+    // Sleeps as long as needed to keep moving bytes (since start) within the I/O budget.
+    void throttle(std::chrono::steady_clock::time_point start, uint64_t bytes)
+    {
+        if (compaction_bytes_per_sec == 0)
+            return;
+        std::unique_lock<std::mutex> lock(compactor_m);
+        compactor_cv.wait_until(lock, start + std::chrono::microseconds(bytes * 1000000 / compaction_bytes_per_sec),
+                                [&] { return stopping; });
+    }
+
+    // Copies the live records of file (which is not the active one, so it does not change) to
+    // file.compact, then swaps the copy in. A put is live if the index still points at it; a
+    // tombstone is kept while the key has no value and older files may still hold one.
+    void compact(const std::shared_ptr<DataFile>& file)
+    {
+        struct Moved
+        {
+            std::string key;
+            uint64_t old_offset, new_offset, n;
+        };
+
+        std::string tmp_path = file->path + ".compact", tmp_hint_path = hint_path(file->id) + ".compact";
+        int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            std::cerr << "Could not open " << tmp_path << ": " << strerror(errno) << "\n";
+            return;
+        }
+        auto abandon = [&](const char* what) {
+            if (what)
+                std::cerr << "Compaction of " << file->path << " failed, could not " << what << ": " << strerror(errno) << "\n";
+            close(fd);
+            unlink(tmp_path.c_str());
+            unlink(tmp_hint_path.c_str());
+        };
+
+        bool oldest;
+        {
+            std::shared_lock<std::shared_mutex> lock(index_m);
+            oldest = files.begin()->first == file->id;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        uint64_t offset = 0, size = 0, moved_bytes = 0, tombstone_bytes = 0;
+        std::vector<HintEntry> entries;
+        std::vector<Moved> moved;
+        std::string record;
+        while (offset < file->size)
+        {
+            uint32_t header[3];
+            if (!read_at(file->fd, (char*)header, HEADER_BYTES, offset))
+                return abandon("read");
+            uint64_t n = record_bytes(header[1], header[2] == TOMBSTONE ? 0 : header[2]);
+            record.resize(n);
+            if (!read_at(file->fd, &record[0], n, offset))
+                return abandon("read");
+            std::string key = record.substr(HEADER_BYTES, header[1]);
+            uint64_t value_offset = offset + HEADER_BYTES + key.size();
+
+            bool keep;
+            {
+                std::shared_lock<std::shared_mutex> lock(index_m);
+                auto it = index.find(key);
+                if (header[2] == TOMBSTONE)
+                    keep = !oldest && it == index.end();
+                else
+                    keep = it != index.end() && it->second.file_id == file->id && it->second.offset == value_offset;
+            }
+            moved_bytes += n;
+            if (keep)
+            {
+                // Copied as is, the crc stays valid.
+                if (!write_at(fd, record.data(), n, size))
+                    return abandon("write");
+                entries.push_back({key, header[2], size + HEADER_BYTES + key.size()});
+                if (header[2] == TOMBSTONE)
+                    tombstone_bytes += n;
+                else
+                    moved.push_back({key, value_offset, entries.back().value_offset, n});
+                size += n;
+                moved_bytes += n;
+            }
+            offset += n;
+            throttle(start, moved_bytes);
+            if (is_stopping())
+                return abandon(nullptr);
+        }
+
+        if (size > 0 && (!io->sync(fd) || !write_hint(tmp_hint_path, entries, size)))
+            return abandon("sync");
+
+        std::shared_ptr<DataFile> compacted;
+        if (size > 0)
+        {
+            compacted = std::make_shared<DataFile>();
+            compacted->id = file->id;
+            compacted->path = file->path;
+            compacted->fd = fd;
+            compacted->size = size;
+            compacted->tombstones = tombstone_bytes;
+        }
+        {
+            std::unique_lock<std::shared_mutex> lock(index_m);
+            // Keys written again since they were copied keep their new location, and their copy is dead.
+            for (auto& m : moved)
+            {
+                auto it = index.find(m.key);
+                if (it != index.end() && it->second.file_id == file->id && it->second.offset == m.old_offset)
+                    it->second.offset = m.new_offset;
+                else
+                    compacted->dead += m.n;
+            }
+            if (compacted)
+            {
+                if (rename(tmp_path.c_str(), file->path.c_str()) != 0 ||
+                    rename(tmp_hint_path.c_str(), hint_path(file->id).c_str()) != 0)
+                    fail("Could not replace " + file->path); // the index already points into the new file.
+                files[file->id] = compacted;
+            }
+            else
+            {
+                files.erase(file->id);
+                unlink(file->path.c_str());
+                unlink(hint_path(file->id).c_str());
+            }
+        }
+        if (!compacted)
+            abandon(nullptr);
+
+        compactions++;
+        reclaimed_bytes += file->size - size;
+        compacted_bytes += size;
+    }
+
+    std::string dir;
+    size_t max_file_bytes;
+    double compaction_ratio;
+    size_t compaction_bytes_per_sec;
+    Durability durability;
+    std::chrono::microseconds group_commit_window;
+    std::unique_ptr<DiskIO> io;
+
+    std::mutex write_m; // serializes writers: appends, the active file and index changes.
+    std::shared_ptr<DataFile> active;
+    uint64_t appended = 0; // writes appended so far, numbering them for group commit.
+    std::vector<HintEntry> active_entries; // the records of the active file, for its hint.
+
+    std::shared_mutex index_m; // guards the index and files. Writers and the compactor take it to change them.
+    std::unordered_map<std::string, Location> index;
+    std::map<uint32_t, std::shared_ptr<DataFile>> files; // by id, the active file last.
+
+    std::mutex sync_m; // guards everything below, for group commit.
+    std::condition_variable sync_cv;
+    uint64_t synced = 0; // writes up to this number are synced.
+    bool syncing = false; // a leader is syncing.
+    uint64_t group_syncs = 0, group_synced_writes = 0;
+
+    std::mutex compactor_m; // guards hints and stopping.
+    std::condition_variable compactor_cv;
+    std::deque<std::pair<std::shared_ptr<DataFile>, std::vector<HintEntry>>> hints; // files whose hint is to be written.
+    bool stopping = false;
+    std::thread compactor;
+
+    std::atomic<uint64_t> foreground_bytes{0}; // written by requests.
+    std::atomic<uint64_t> compacted_bytes{0}, reclaimed_bytes{0}, compactions{0};
+};
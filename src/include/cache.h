@@ -0,0 +1,237 @@
+// Sharded in-memory cache used by the server to keep recently used (key, value) pairs.
+// The key space is split into a number of independent shards, each with its own lock and
+// eviction state. A key always maps to the same shard (chosen by its hash), so requests for
+// different keys rarely contend on the same mutex.
+//
+// The cache is bounded by a byte budget rather than an entry count, since the values are images
+// from a few KB to several MB. Every entry is charged for its key, its value and the memory used
+// by the bookkeeping around it (see entry_charge).
+//
+// Which key is evicted is decided by a policy object per shard (see eviction.h), chosen at startup.
+// Each map entry carries the policy's hook, so deletes, overwrites and evictions are O(1). Entries
+// that leave the cache are unlinked under the lock, but their memory (possibly a multi-MB image)
+// is freed after the lock is released.
+//
+// Values are shared immutable buffers (CacheValue), so a hit only copies a pointer and increments
+// a reference count, whatever the size of the image.
+#pragma once
+
+#include "eviction.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class ShardedCache
+{
+public:
+    struct Stats
+    {
+        size_t hits = 0, misses = 0, evictions = 0, rejected = 0;
+        size_t used_bytes = 0, entries = 0;
+    };
+
+    // capacity_bytes is the total budget and is split evenly over the shards. A single entry
+    // whose charge is more than max_object_fraction of the total budget is never admitted (nor is
+    // one larger than a shard's budget, since it could not fit anyway).
+    // policy is one of the names accepted by make_policy (see eviction.h).
+    ShardedCache(size_t num_shards, size_t capacity_bytes, double max_object_fraction,
+                 const std::string& policy)
+    {
+        if (num_shards == 0)
+            num_shards = 1;
+        size_t per_shard = capacity_bytes / num_shards;
+        max_object_bytes = std::min((size_t)(capacity_bytes * max_object_fraction), per_shard);
+
+        for (size_t i = 0; i < num_shards; i++)
+        {
+            shards.emplace_back(new Shard());
+            shards.back()->capacity_bytes = per_shard;
+            shards.back()->policy = make_policy(policy, per_shard);
+        }
+    }
+
+    ShardedCache(const ShardedCache&) = delete;
+    ShardedCache& operator=(const ShardedCache&) = delete;
+
+    // Sets value to the (shared) value of key. Returns false if key is not in the cache.
+    bool get(const std::string& key, CacheValue& value)
+    {
+        Shard& s = shard_for(key);
+        std::lock_guard<std::mutex> lock(s.m);
+        auto it = s.map.find(key);
+        if (it == s.map.end())
+        {
+            s.stats.misses++;
+            return false;
+        }
+        s.stats.hits++;
+        s.policy->on_hit(&it->second);
+        value = it->second.value;
+        return true;
+    }
+
+    // Stores a (key, value) pair in the cache, evicting pairs from the same shard (as chosen by the
+    // policy) until it fits.
+    // Returns false if the pair is too large to be admitted (any old value of key is dropped).
+    bool put(const std::string& key, const CacheValue& value)
+    {
+        Shard& s = shard_for(key);
+        Garbage garbage; // destroyed after the lock is released.
+        std::lock_guard<std::mutex> lock(s.m);
+        auto it = s.map.find(key);
+        if (it != s.map.end())
+            return replace(s, it, value, garbage);
+
+        size_t charge = entry_charge(key, value);
+        if (charge > max_object_bytes)
+        {
+            s.stats.rejected++;
+            return false;
+        }
+
+        while (s.used_bytes + charge > s.capacity_bytes && !s.map.empty())
+            evict_one(s, garbage);
+
+        it = s.map.emplace(key, CacheEntry()).first;
+        CacheEntry& e = it->second;
+        e.key = &it->first;
+        e.value = value;
+        e.charge = charge;
+        s.policy->on_insert(&e);
+        s.used_bytes += charge;
+        return true;
+    }
+
+    // Replaces the value of key only if it is already cached. Returns true if it was.
+    bool update(const std::string& key, const CacheValue& value)
+    {
+        Shard& s = shard_for(key);
+        Garbage garbage;
+        std::lock_guard<std::mutex> lock(s.m);
+        auto it = s.map.find(key);
+        if (it == s.map.end())
+            return false;
+        replace(s, it, value, garbage);
+        return true;
+    }
+
+    void erase(const std::string& key)
+    {
+        Shard& s = shard_for(key);
+        Garbage garbage;
+        std::lock_guard<std::mutex> lock(s.m);
+        auto it = s.map.find(key);
+        if (it == s.map.end())
+            return;
+        remove(s, it, garbage);
+    }
+
+    size_t num_shards() const { return shards.size(); }
+
+    // Sum of the counters of all shards.
+    Stats stats()
+    {
+        Stats total;
+        for (auto& s : shards)
+        {
+            std::lock_guard<std::mutex> lock(s->m);
+            total.hits += s->stats.hits;
+            total.misses += s->stats.misses;
+            total.evictions += s->stats.evictions;
+            total.rejected += s->stats.rejected;
+            total.used_bytes += s->used_bytes;
+            total.entries += s->map.size();
+        }
+        return total;
+    }
+
+private:
+    using Map = std::unordered_map<std::string, CacheEntry>;
+    // Map nodes taken out of a shard. Declared before the lock_guard in every method, so that
+    // they are destroyed after it, outside the critical section.
+    using Garbage = std::vector<Map::node_type>;
+
+    struct Shard
+    {
+        std::mutex m; // guards everything below, for this shard only.
+        Map map; // the entries are linked into the policy's lists through their hooks.
+        std::unique_ptr<EvictionPolicy> policy;
+        size_t used_bytes = 0;
+        size_t capacity_bytes = 0;
+        Stats stats;
+    };
+
+    // Approximate memory used by one entry: the key and value bytes, the hash-map node (key
+    // string, CacheEntry with the policy hook, next pointer, cached hash, bucket slot) and the
+    // shared value's control block and string header.
+    static size_t entry_charge(const std::string& key, const CacheValue& value)
+    {
+        const size_t shared_value = 2 * sizeof(void*) + sizeof(std::string);
+        return sizeof(Map::value_type) + 3 * sizeof(void*) + shared_value + key.size() + value->size();
+    }
+
+    // Called with s.m held. Drops the entry if the new value can no longer be admitted.
+    bool replace(Shard& s, Map::iterator it, const CacheValue& value, Garbage& garbage)
+    {
+        CacheEntry& e = it->second;
+        size_t new_charge = entry_charge(it->first, value);
+        if (new_charge > max_object_bytes)
+        {
+            s.stats.rejected++;
+            remove(s, it, garbage);
+            return false;
+        }
+
+        size_t old_charge = e.charge;
+        e.value = value;
+        e.charge = new_charge;
+        s.used_bytes = s.used_bytes - old_charge + new_charge;
+        s.policy->on_update(&e, old_charge);
+        // A larger value may push the shard over its budget. The policy may then pick the
+        // overwritten entry itself as a victim.
+        while (s.used_bytes > s.capacity_bytes)
+        {
+            if (evict_one(s, garbage) == &e)
+                return false;
+        }
+        return true;
+    }
+
+    // Called with s.m held.
+    void remove(Shard& s, Map::iterator it, Garbage& garbage)
+    {
+        s.policy->on_erase(&it->second);
+        s.used_bytes -= it->second.charge;
+        garbage.push_back(s.map.extract(it));
+    }
+
+    // Called with s.m held. Returns the evicted entry (only valid until garbage is destroyed).
+    CacheEntry* evict_one(Shard& s, Garbage& garbage)
+    {
+        CacheEntry* victim = s.policy->evict();
+        s.used_bytes -= victim->charge;
+        s.stats.evictions++;
+        garbage.push_back(s.map.extract(*victim->key));
+        return victim;
+    }
+
+    Shard& shard_for(const std::string& key)
+    {
+        // The maps inside the shards use the same std::hash, so mix the bits before picking a
+        // shard. Otherwise all keys of one shard would land in a correlated subset of buckets.
+        size_t h = std::hash<std::string>()(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return *shards[h % shards.size()];
+    }
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    size_t max_object_bytes;
+};
@@ -0,0 +1,580 @@
+// Storage engine on Apache Cassandra: keyspace IMAGE_STORE, table image_store (image_id text
+// primary key, image_data blob). The queries are prepared once at startup; every request only
+// binds its values, and keeps its own statements, futures and results, so requests run in parallel.
+//
+// The operations are asynchronous: every query gets a callback (cass_future_set_callback) that
+// starts the next step of the operation, on the driver's IO thread, and the last step calls the
+// caller's done. No thread waits for Cassandra, so the event front end (event_server.h) keeps
+// thousands of queries in flight with one thread. The synchronous operations wait for these.
+//
+// Chunked layout for large images (chunk_bytes > 0). An image larger than the chunk size is split
+// into chunks stored as rows of image_chunks, under (image_id, version, chunk number). Its
+// image_store row only holds the number of chunks and the version, and is written after all
+// chunks, so a reader never sees a partly written image. Images up to the chunk size stay inline
+// in image_store (chunks = 0), as before.
+//
+// version is a microsecond timestamp. Every image_store row, inline or not, and every chunk is
+// written with a new version as its write timestamp, so the newest version wins even if concurrent
+// overwrites of a key arrive out of order. A write then deletes the chunks of all older versions of
+// the key with a range delete at its own timestamp, which also covers chunks of an older write that
+// arrive after it. Inline writes do that too if the key may have chunks: with chunk_bytes > 0, or
+// if image_chunks had rows at startup (written by a database started with another --chunk-bytes).
+// Otherwise an inline write is the insert alone. The delete is not waited for, since a failed one
+// only leaves garbage, not a wrong image. /delete always deletes the key's chunks.
+//
+// Conditional writes (put_if_absent, IF NOT EXISTS) cannot carry USING TIMESTAMP: Cassandra gives
+// them the timestamp of their Paxos ballot, from the clock of the Cassandra node that coordinates
+// them, while all other writes use the database's clock. The database's key lock lets one write of
+// a key run at a time, so they are still applied in order as long as the two clocks differ by less
+// than the time between two writes of a key: Cassandra on the same host (DB_IP) or clocks kept in
+// sync with NTP. For the same reason only one database process may write to the keyspace.
+//
+// Plain inserts of inline images can be grouped into unlogged batches (see write_batcher.h).
+#pragma once
+
+#include "storage_engine.h"
+#include "write_batcher.h"
+
+#include <cassandra.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class CassandraEngine : public StorageEngine
+{
+public:
+    // Connects to the node at contact_points and creates the keyspace and tables if needed.
+    // Exits if a query cannot be prepared, since no request could be served.
+    CassandraEngine(const char* contact_points, size_t chunk_bytes, std::chrono::microseconds batch_window,
+                    size_t batch_max_statements, size_t batch_max_bytes)
+        : chunk_bytes(chunk_bytes)
+    {
+        // 1. Connect to Cassandra
+        cluster = cass_cluster_new();
+        cass_cluster_set_contact_points(cluster, contact_points);
+        session = cass_session_new();
+        CassFuture* connect_future = cass_session_connect(session, cluster);
+        cass_future_wait(connect_future);
+        cass_future_free(connect_future);
+
+        // 2. Create keyspace
+        run("CREATE KEYSPACE IF NOT EXISTS IMAGE_STORE "
+            "WITH replication = {'class': 'SimpleStrategy', 'replication_factor': 1};");
+        // 3. Use keyspace
+        run("USE IMAGE_STORE;");
+        // 4. Create table
+        run("CREATE TABLE IF NOT EXISTS image_store ("
+            "image_id text PRIMARY KEY, "
+            "image_data BLOB);");
+        // 4b. Columns and table of the chunked layout. Adding a column that already exists fails,
+        // which is fine.
+        run("ALTER TABLE image_store ADD chunks int;");
+        run("ALTER TABLE image_store ADD version bigint;");
+        run("CREATE TABLE IF NOT EXISTS image_chunks ("
+            "image_id text, version bigint, chunk int, data BLOB, "
+            "PRIMARY KEY (image_id, version, chunk));");
+
+        // 5. Prepare the queries used by the requests.
+        insert_prepared = prepare(
+            "INSERT INTO image_store (image_id, image_data, chunks) VALUES (?, ?, 0) USING TIMESTAMP ?;");
+        insert_if_absent_prepared = prepare(
+            "INSERT INTO image_store (image_id, image_data, chunks) VALUES (?, ?, 0) IF NOT EXISTS;");
+        select_prepared = prepare(
+            "SELECT image_data, chunks, version FROM image_store WHERE image_id = ?;");
+        delete_prepared = prepare(
+            "DELETE FROM image_store WHERE image_id = ?;");
+        insert_chunk_prepared = prepare(
+            "INSERT INTO image_chunks (image_id, version, chunk, data) VALUES (?, ?, ?, ?) USING TIMESTAMP ?;");
+        select_chunk_prepared = prepare(
+            "SELECT data FROM image_chunks WHERE image_id = ? AND version = ? AND chunk = ?;");
+        insert_header_prepared = prepare(
+            "INSERT INTO image_store (image_id, image_data, chunks, version) VALUES (?, 0x, ?, ?) "
+            "USING TIMESTAMP ?;");
+        insert_header_if_absent_prepared = prepare(
+            "INSERT INTO image_store (image_id, image_data, chunks, version) VALUES (?, 0x, ?, ?) "
+            "IF NOT EXISTS;");
+        delete_older_versions_prepared = prepare(
+            "DELETE FROM image_chunks USING TIMESTAMP ? WHERE image_id = ? AND version < ?;");
+        delete_version_prepared = prepare(
+            "DELETE FROM image_chunks USING TIMESTAMP ? WHERE image_id = ? AND version = ?;");
+        delete_chunks_prepared = prepare(
+            "DELETE FROM image_chunks WHERE image_id = ?;");
+        select_keys_prepared = prepare(
+            "SELECT image_id FROM image_store;");
+
+        may_have_chunks = chunk_bytes > 0 || has_rows("SELECT image_id FROM image_chunks LIMIT 1;");
+
+        write_batcher.reset(new WriteBatcher(session, batch_window, batch_max_statements, batch_max_bytes));
+    }
+
+    CassandraEngine(const CassandraEngine&) = delete;
+    CassandraEngine& operator=(const CassandraEngine&) = delete;
+
+    ~CassandraEngine()
+    {
+        write_batcher.reset(); // sends what is still queued.
+        for (const CassPrepared* prepared : {insert_prepared, insert_if_absent_prepared, select_prepared,
+                                             delete_prepared, insert_chunk_prepared, select_chunk_prepared,
+                                             insert_header_prepared, insert_header_if_absent_prepared,
+                                             delete_older_versions_prepared, delete_version_prepared,
+                                             delete_chunks_prepared, select_keys_prepared})
+            cass_prepared_free(prepared);
+        cass_session_free(session);
+        cass_cluster_free(cluster);
+    }
+
+    // The synchronous operations wait for the asynchronous ones.
+    Status put(const std::string& key, const std::string& value) override
+    {
+        return wait([&](Done done) { put_async(key, value, std::move(done)); });
+    }
+
+    Status put_if_absent(const std::string& key, const std::string& value) override
+    {
+        return wait([&](Done done) { put_if_absent_async(key, value, std::move(done)); });
+    }
+
+    Status get(const std::string& key, std::vector<Blob>& value) override
+    {
+        auto answered = std::make_shared<std::promise<std::pair<Status, std::vector<Blob>>>>();
+        get_async(key, [answered](Status status, std::vector<Blob> pieces) {
+            answered->set_value({status, std::move(pieces)});
+        });
+        std::pair<Status, std::vector<Blob>> answer = answered->get_future().get();
+        for (Blob& piece : answer.second)
+            value.push_back(std::move(piece));
+        return answer.first;
+    }
+
+    Status erase(const std::string& key) override
+    {
+        return wait([&](Done done) { erase_async(key, std::move(done)); });
+    }
+
+    void put_async(const std::string& key, const std::string& value, Done done) override
+    {
+        if (chunk_bytes > 0 && value.size() > chunk_bytes)
+        {
+            write_chunked(key, value, false, [done](CassError rc, bool) { done(rc == CASS_OK ? OK : FAILED); });
+            return;
+        }
+
+        int64_t version = new_version();
+        CassStatement* stmt = cass_prepared_bind(insert_prepared);
+        cass_statement_bind_string(stmt, 0, key.c_str());
+        cass_statement_bind_bytes(stmt, 1, reinterpret_cast<const cass_byte_t*>(value.data()), value.size());
+        cass_statement_bind_int64(stmt, 2, version); // USING TIMESTAMP
+
+        // The chunks the key may have from older versions are deleted while the row is written.
+        if (may_have_chunks)
+            execute_async(delete_versions(delete_older_versions_prepared, key, version), [](Answer) {});
+        auto finished = [done](CassError rc) { done(rc == CASS_OK ? OK : FAILED); };
+        if (write_batcher->accepts(value.size()))
+            write_batcher->write_async(stmt, value.size(), finished);
+        else
+            execute_async(stmt, [finished](Answer answer) { finished(answer.rc); });
+    }
+
+    // One round trip (a lightweight transaction); the old value is never read.
+    void put_if_absent_async(const std::string& key, const std::string& value, Done done) override
+    {
+        if (chunk_bytes > 0 && value.size() > chunk_bytes)
+        {
+            write_chunked(key, value, true, [done](CassError rc, bool applied) {
+                done(rc != CASS_OK ? FAILED : applied ? OK : EXISTS);
+            });
+            return;
+        }
+
+        CassStatement* stmt = cass_prepared_bind(insert_if_absent_prepared);
+        cass_statement_bind_string(stmt, 0, key.c_str());
+        cass_statement_bind_bytes(stmt, 1, reinterpret_cast<const cass_byte_t*>(value.data()), value.size());
+        execute_async(stmt, [done](Answer answer) { done(lwt_status(answer)); });
+    }
+
+    // The pieces point into the driver's result buffers, which they keep alive.
+    void get_async(const std::string& key, GetDone done) override
+    {
+        CassStatement* stmt = cass_prepared_bind(select_prepared);
+        cass_statement_bind_string(stmt, 0, key.c_str());
+        execute_async(stmt, [this, key, done](Answer answer) {
+            if (!answer.result)
+                return done(FAILED, {});
+            if (cass_result_row_count(answer.result.get()) == 0)
+                return done(NOT_FOUND, {});
+
+            // Get first (and only) row
+            const CassRow* row = cass_result_first_row(answer.result.get());
+            cass_int32_t chunks = 0; // stays 0 if null, in rows written before the chunked layout existed.
+            cass_value_get_int32(cass_row_get_column_by_name(row, "chunks"), &chunks);
+            if (chunks == 0)
+                return done(OK, {first_blob(answer.result)});
+
+            cass_int64_t version = 0;
+            cass_value_get_int64(cass_row_get_column_by_name(row, "version"), &version);
+            read_chunks(key, version, chunks, done);
+        });
+    }
+
+    void erase_async(const std::string& key, Done done) override
+    {
+        // The key may have chunks even if chunk_bytes is 0 now.
+        std::vector<CassStatement*> stmts = {cass_prepared_bind(delete_prepared), cass_prepared_bind(delete_chunks_prepared)};
+        for (CassStatement* stmt : stmts)
+            cass_statement_bind_string(stmt, 0, key.c_str());
+        execute_all_async(stmts, [done](std::vector<Answer> answers) {
+            bool ok = true;
+            for (const Answer& answer : answers)
+                ok = ok && answer.rc == CASS_OK;
+            done(ok ? OK : FAILED);
+        });
+    }
+
+    bool asynchronous() const override { return true; }
+
+    // Pages through all keys of image_store: a full table scan, for the key filter.
+    bool for_each_key(const std::function<void(const std::string&)>& fn) override
+    {
+        CassStatement* stmt = cass_prepared_bind(select_keys_prepared);
+        cass_statement_set_paging_size(stmt, KEY_SCAN_PAGE_ROWS);
+        bool ok = true, more = true;
+        while (ok && more)
+        {
+            CassFuture* future = execute(stmt);
+            const CassResult* result = nullptr;
+            if (cass_future_error_code(future) == CASS_OK)
+                result = cass_future_get_result(future);
+            cass_future_free(future);
+            if (result == nullptr)
+            {
+                ok = false;
+                break;
+            }
+
+            CassIterator* rows = cass_iterator_from_result(result);
+            while (cass_iterator_next(rows))
+            {
+                const char* key;
+                size_t key_length;
+                if (cass_value_get_string(cass_row_get_column(cass_iterator_get_row(rows), 0), &key, &key_length) == CASS_OK)
+                    fn(std::string(key, key_length));
+            }
+            cass_iterator_free(rows);
+            more = cass_result_has_more_pages(result);
+            if (more)
+                cass_statement_set_paging_state(stmt, result);
+            cass_result_free(result);
+        }
+        cass_statement_free(stmt);
+        return ok;
+    }
+
+    void print_stats(std::ostream& out) override
+    {
+        out << "Cassandra queries: " << queries_sent.exchange(0) << " (batches not included), max in flight: "
+            << max_queries_in_flight.exchange(0) << "\n";
+        count_in_flight(0); // starts the next maximum at the queries in flight now.
+
+        WriteBatcher::Stats bs = write_batcher->stats();
+        if (bs.batches > 0)
+            out << "Write batches: " << bs.batches << ", writes per batch: " << (double)bs.batched_writes / bs.batches
+                << ", largest batch: " << bs.max_batch << "\n";
+    }
+
+private:
+    static const int KEY_SCAN_PAGE_ROWS = 5000;
+
+    // Runs a query without values and waits for it. Used for the schema; errors are ignored.
+    void run(const char* query)
+    {
+        CassStatement* stmt = cass_statement_new(query, 0);
+        CassFuture* future = cass_session_execute(session, stmt);
+        cass_future_wait(future);
+        cass_statement_free(stmt);
+        cass_future_free(future);
+    }
+
+    // Runs a query without values and waits for it. True if it returned rows, or failed.
+    bool has_rows(const char* query)
+    {
+        CassStatement* stmt = cass_statement_new(query, 0);
+        CassFuture* future = cass_session_execute(session, stmt);
+        bool rows = true;
+        if (cass_future_error_code(future) == CASS_OK)
+        {
+            const CassResult* result = cass_future_get_result(future);
+            rows = cass_result_row_count(result) > 0;
+            cass_result_free(result);
+        }
+        cass_statement_free(stmt);
+        cass_future_free(future);
+        return rows;
+    }
+
+    // Prepares query once, so that Cassandra does not parse it again for every request.
+    const CassPrepared* prepare(const char* query)
+    {
+        CassFuture* future = cass_session_prepare(session, query);
+        cass_future_wait(future);
+        if (cass_future_error_code(future) != CASS_OK)
+        {
+            const char* message;
+            size_t message_length;
+            cass_future_error_message(future, &message, &message_length);
+            std::cerr << "Could not prepare \"" << query << "\": " << std::string(message, message_length) << "\n";
+            exit(1);
+        }
+        const CassPrepared* prepared = cass_future_get_prepared(future);
+        cass_future_free(future);
+        return prepared;
+    }
+
+    // n new queries start (or 0, to only update the maximum).
+    void count_in_flight(int n)
+    {
+        queries_sent += n;
+        int now = (queries_in_flight += n);
+        int max = max_queries_in_flight;
+        while (now > max && !max_queries_in_flight.compare_exchange_weak(max, now)) {}
+    }
+
+    // Runs stmt and waits for its result. The caller frees the returned future.
+    CassFuture* execute(CassStatement* stmt)
+    {
+        count_in_flight(1);
+        CassFuture* future = cass_session_execute(session, stmt);
+        cass_future_wait(future);
+        queries_in_flight--;
+        return future;
+    }
+
+    // What a query answered: its error code, and its result if it succeeded.
+    struct Answer
+    {
+        CassError rc;
+        std::shared_ptr<const CassResult> result;
+    };
+    using Then = std::function<void(Answer)>;
+
+    // Runs stmt without waiting and frees it; then is called with the answer on a driver thread.
+    void execute_async(CassStatement* stmt, Then then)
+    {
+        count_in_flight(1);
+        CassFuture* future = cass_session_execute(session, stmt);
+        cass_future_set_callback(future, on_answer, new Callback{this, std::move(then)});
+        cass_future_free(future);
+        cass_statement_free(stmt);
+    }
+
+    struct Callback
+    {
+        CassandraEngine* engine;
+        Then then;
+    };
+
+    static void on_answer(CassFuture* future, void* data)
+    {
+        std::unique_ptr<Callback> callback(static_cast<Callback*>(data));
+        callback->engine->queries_in_flight--;
+        Answer answer{cass_future_error_code(future), nullptr};
+        if (answer.rc == CASS_OK)
+            answer.result.reset(cass_future_get_result(future), cass_result_free);
+        callback->then(std::move(answer));
+    }
+
+    // Runs all statements at the same time and frees them; then is called with their answers, in
+    // the order of stmts, once the last one has arrived.
+    void execute_all_async(const std::vector<CassStatement*>& stmts, std::function<void(std::vector<Answer>)> then)
+    {
+        if (stmts.empty())
+            return then({});
+
+        struct Join
+        {
+            std::mutex m;
+            std::vector<Answer> answers;
+            size_t left;
+            std::function<void(std::vector<Answer>)> then;
+        };
+        auto join = std::make_shared<Join>();
+        join->answers.resize(stmts.size());
+        join->left = stmts.size();
+        join->then = std::move(then);
+        for (size_t i = 0; i < stmts.size(); i++)
+            execute_async(stmts[i], [join, i](Answer answer) {
+                bool last;
+                {
+                    std::lock_guard<std::mutex> lock(join->m);
+                    join->answers[i] = std::move(answer);
+                    last = --join->left == 0;
+                }
+                if (last)
+                    join->then(std::move(join->answers));
+            });
+    }
+
+    // Whether a lightweight transaction was applied.
+    static Status lwt_status(const Answer& answer)
+    {
+        if (!answer.result)
+            return FAILED;
+        cass_bool_t applied = cass_false;
+        cass_value_get_bool(cass_row_get_column(cass_result_first_row(answer.result.get()), 0), &applied);
+        return applied ? OK : EXISTS;
+    }
+
+    // Starts an asynchronous operation with a Done and waits for its status.
+    template <typename F>
+    static Status wait(F start)
+    {
+        auto answered = std::make_shared<std::promise<Status>>();
+        start([answered](Status status) { answered->set_value(status); });
+        return answered->get_future().get();
+    }
+
+    // A new version, larger than any given out before by this process.
+    int64_t new_version()
+    {
+        int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        int64_t last = last_version;
+        int64_t next;
+        do
+            next = std::max(now, last + 1);
+        while (!last_version.compare_exchange_weak(last, next));
+        return next;
+    }
+
+    // Stores image under key in chunks of chunk_bytes, written in parallel, then its image_store row.
+    // With if_absent, the image is only stored if key does not exist. done gets the error code and
+    // whether the image was stored.
+    void write_chunked(const std::string& key, const std::string& image, bool if_absent,
+                       std::function<void(CassError, bool)> done)
+    {
+        int64_t version = new_version();
+        int32_t chunks = (image.size() + chunk_bytes - 1) / chunk_bytes;
+        std::vector<CassStatement*> stmts;
+        for (int32_t c = 0; c < chunks; c++)
+        {
+            size_t offset = c * chunk_bytes;
+            CassStatement* stmt = cass_prepared_bind(insert_chunk_prepared);
+            cass_statement_bind_string(stmt, 0, key.c_str());
+            cass_statement_bind_int64(stmt, 1, version);
+            cass_statement_bind_int32(stmt, 2, c);
+            cass_statement_bind_bytes(stmt, 3, reinterpret_cast<const cass_byte_t*>(image.data()) + offset,
+                                      std::min(chunk_bytes, image.size() - offset));
+            cass_statement_bind_int64(stmt, 4, version); // USING TIMESTAMP
+            stmts.push_back(stmt);
+        }
+        execute_all_async(stmts, [this, key, if_absent, version, chunks, done](std::vector<Answer> answers) {
+            for (const Answer& answer : answers)
+                if (answer.rc != CASS_OK)
+                    return finish_chunked(key, version, answer.rc, false, done);
+
+            CassStatement* stmt = cass_prepared_bind(if_absent ? insert_header_if_absent_prepared : insert_header_prepared);
+            cass_statement_bind_string(stmt, 0, key.c_str());
+            cass_statement_bind_int32(stmt, 1, chunks);
+            cass_statement_bind_int64(stmt, 2, version);
+            if (!if_absent)
+                cass_statement_bind_int64(stmt, 3, version); // USING TIMESTAMP
+            execute_async(stmt, [this, key, if_absent, version, done](Answer answer) {
+                bool applied = answer.rc == CASS_OK && (!if_absent || lwt_status(answer) == OK);
+                finish_chunked(key, version, answer.rc, applied, done);
+            });
+        });
+    }
+
+    // Deletes the chunks that no image_store row refers to: those of version if the image was not
+    // stored, or those of the versions it replaced. Then calls done.
+    void finish_chunked(const std::string& key, int64_t version, CassError rc, bool applied,
+                        const std::function<void(CassError, bool)>& done)
+    {
+        CassStatement* stmt = delete_versions(applied ? delete_older_versions_prepared : delete_version_prepared, key, version);
+        execute_async(stmt, [rc, applied, done](Answer) { done(rc, applied); });
+    }
+
+    // Binds a delete of chunks of key, relative to version, at version as its timestamp: it covers the
+    // chunks written with older versions, whenever they arrive.
+    CassStatement* delete_versions(const CassPrepared* prepared, const std::string& key, int64_t version)
+    {
+        CassStatement* stmt = cass_prepared_bind(prepared);
+        cass_statement_bind_int64(stmt, 0, version); // USING TIMESTAMP
+        cass_statement_bind_string(stmt, 1, key.c_str());
+        cass_statement_bind_int64(stmt, 2, version);
+        return stmt;
+    }
+
+    // Reads all chunks of version of key in parallel, into one piece per chunk. The status is
+    // NOT_FOUND if a chunk is gone (the key was deleted or overwritten since its row was read).
+    void read_chunks(const std::string& key, int64_t version, int32_t chunks, GetDone done)
+    {
+        std::vector<CassStatement*> stmts;
+        for (int32_t c = 0; c < chunks; c++)
+        {
+            CassStatement* stmt = cass_prepared_bind(select_chunk_prepared);
+            cass_statement_bind_string(stmt, 0, key.c_str());
+            cass_statement_bind_int64(stmt, 1, version);
+            cass_statement_bind_int32(stmt, 2, c);
+            stmts.push_back(stmt);
+        }
+        execute_all_async(stmts, [done](std::vector<Answer> answers) {
+            Status status = OK;
+            std::vector<Blob> value;
+            for (const Answer& answer : answers)
+            {
+                if (!answer.result)
+                    status = FAILED;
+                else if (cass_result_row_count(answer.result.get()) == 0)
+                {
+                    if (status == OK)
+                        status = NOT_FOUND;
+                }
+                else
+                    value.push_back(first_blob(answer.result));
+            }
+            if (status != OK)
+                value.clear();
+            done(status, std::move(value));
+        });
+    }
+
+    // The blob in the first column of the first row of result.
+    static Blob first_blob(const std::shared_ptr<const CassResult>& result)
+    {
+        const cass_byte_t* bytes;
+        size_t size;
+        cass_value_get_bytes(cass_row_get_column(cass_result_first_row(result.get()), 0), &bytes, &size);
+        return {reinterpret_cast<const char*>(bytes), size, result};
+    }
+
+    size_t chunk_bytes;
+    bool may_have_chunks; // whether inline writes must delete older chunks of the key.
+    CassCluster* cluster;
+    CassSession* session;
+    const CassPrepared* insert_prepared;
+    const CassPrepared* insert_if_absent_prepared;
+    const CassPrepared* select_prepared;
+    const CassPrepared* delete_prepared;
+    const CassPrepared* insert_chunk_prepared;
+    const CassPrepared* select_chunk_prepared;
+    const CassPrepared* insert_header_prepared;
+    const CassPrepared* insert_header_if_absent_prepared;
+    const CassPrepared* delete_older_versions_prepared;
+    const CassPrepared* delete_version_prepared;
+    const CassPrepared* delete_chunks_prepared;
+    const CassPrepared* select_keys_prepared;
+    std::unique_ptr<WriteBatcher> write_batcher; // for inserts of inline images.
+    std::atomic<int> queries_in_flight{0}, max_queries_in_flight{0};
+    std::atomic<size_t> queries_sent{0}; // since the last print_stats.
+    std::atomic<int64_t> last_version{0};
+};
@@ -0,0 +1,238 @@
+// Pool of threads for CPU-heavy work (the image transforms of /rotate and /rotate2), separate
+// from the httplib threads that run the handlers. A handler hands its transform to the pool and
+// waits for it, so however many rotations arrive at once, only as many run as the pool has
+// threads (one per core by default), and a cheap request such as a cache hit on /read does not
+// have to share the core with all of them. The pool threads also run at a lower priority (a
+// higher nice value), so a handler thread that becomes runnable gets the core first.
+//
+// The queue of transforms waiting for a thread is bounded: when it is full run() refuses the job,
+// and the handler answers that the server is busy instead of holding its thread for a long wait.
+//
+// A single transform can also be split into parts (parallel_for). The thread that splits it runs
+// parts itself and the pool threads that are idle at that moment help, so a large image uses the
+// free cores, while under load, when no thread is idle, the parts simply run one after another.
+#pragma once
+
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class CpuPool
+{
+public:
+    struct Stats
+    {
+        size_t threads = 0;
+        size_t queued = 0, max_queued = 0; // jobs waiting for a thread now, and the most at once.
+        size_t jobs = 0; // run to completion.
+        size_t rejected = 0; // refused because the queue was full.
+        double total_wait_ms = 0, max_wait_ms = 0; // in the queue, until a thread took the job.
+        double total_run_ms = 0;
+        size_t parallel_runs = 0, parts = 0; // of parallel_for.
+        size_t parts_helped = 0; // run by pool threads other than the caller.
+    };
+
+    // threads 0 means one per CPU the process may run on. max_queued jobs may wait for a thread
+    // (0 for no limit). The threads run with the given nice value (0 keeps the process's priority).
+    CpuPool(size_t threads, size_t max_queued, int nice) : max_queued(max_queued)
+    {
+        if (threads == 0)
+            threads = usable_cpus();
+        for (size_t i = 0; i < threads; i++)
+            workers.emplace_back([this, nice] { work(nice); });
+    }
+
+    CpuPool(const CpuPool&) = delete;
+    CpuPool& operator=(const CpuPool&) = delete;
+
+    // Finishes the jobs that are queued.
+    ~CpuPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto& t : workers)
+            t.join();
+    }
+
+    // Runs job on a pool thread and waits for it to finish. An exception it throws is rethrown
+    // here. Returns false, without running it, if max_queued jobs are already waiting.
+    bool run(const std::function<void()>& job)
+    {
+        Job j{&job, Clock::now()};
+        std::unique_lock<std::mutex> lock(m);
+        if (max_queued > 0 && queue.size() >= max_queued)
+        {
+            counters.rejected++;
+            return false;
+        }
+        queue.push_back(&j);
+        counters.max_queued = std::max(counters.max_queued, queue.size());
+        cv.notify_one();
+        j.finished.wait(lock, [&] { return j.done; });
+        lock.unlock();
+        if (j.error)
+            std::rethrow_exception(j.error);
+        return true;
+    }
+
+    // Runs part(0) .. part(parts - 1) and returns when all of them have finished. The calling thread
+    // runs parts too, so this does not wait for busy pool threads. part must not throw.
+    void parallel_for(size_t parts, const std::function<void(size_t)>& part)
+    {
+        auto p = std::make_shared<Parts>(&part, parts);
+        {
+            std::lock_guard<std::mutex> lock(m);
+            counters.parallel_runs++;
+            counters.parts += parts;
+            // Helpers hold p, since one may only get to it after the parts are done and this returned.
+            for (size_t i = 0; i + 1 < parts && i < idle; i++)
+                helpers.push_back([this, p] {
+                    size_t n = run_parts(*p);
+                    std::lock_guard<std::mutex> lock(m);
+                    counters.parts_helped += n;
+                });
+        }
+        cv.notify_all();
+        run_parts(*p);
+        std::unique_lock<std::mutex> lock(p->m);
+        p->finished.wait(lock, [&] { return p->done == p->count; });
+    }
+
+    Stats stats()
+    {
+        std::lock_guard<std::mutex> lock(m);
+        Stats s = counters;
+        s.threads = workers.size();
+        s.queued = queue.size();
+        return s;
+    }
+
+    // CPUs in the affinity mask of the process, e.g. 1 after it has been pinned to a core.
+    static size_t usable_cpus()
+    {
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) == 0)
+            return std::max(CPU_COUNT(&set), 1);
+        return std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Lives on the stack of the thread that waits in run().
+    struct Job
+    {
+        const std::function<void()>* fn;
+        Clock::time_point queued;
+        bool done = false;
+        std::exception_ptr error;
+        std::condition_variable finished;
+    };
+
+    // The parts of one parallel_for. Every thread that takes part claims the next part until none
+    // are left.
+    struct Parts
+    {
+        Parts(const std::function<void(size_t)>* part, size_t count) : part(part), count(count) {}
+        const std::function<void(size_t)>* part; // only called for a claimed part, before done == count.
+        size_t count;
+        std::atomic<size_t> next{0};
+        size_t done = 0; // guarded by m.
+        std::mutex m;
+        std::condition_variable finished;
+    };
+
+    // Returns the number of parts this thread ran.
+    static size_t run_parts(Parts& p)
+    {
+        size_t ran = 0;
+        for (size_t i = p.next++; i < p.count; i = p.next++)
+        {
+            (*p.part)(i);
+            ran++;
+        }
+        if (ran > 0)
+        {
+            std::lock_guard<std::mutex> lock(p.m);
+            p.done += ran;
+            if (p.done == p.count)
+                p.finished.notify_one();
+        }
+        return ran;
+    }
+
+    void work(int nice)
+    {
+        if (nice != 0)
+            setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nice); // this thread only, on Linux.
+        std::unique_lock<std::mutex> lock(m);
+        while (true)
+        {
+            idle++;
+            cv.wait(lock, [&] { return stopping || !queue.empty() || !helpers.empty(); });
+            idle--;
+            if (!helpers.empty()) // first, since a job that is already running waits for them.
+            {
+                std::function<void()> help = std::move(helpers.front());
+                helpers.pop_front();
+                lock.unlock();
+                help();
+                lock.lock();
+                continue;
+            }
+            if (queue.empty())
+                return;
+            Job* j = queue.front();
+            queue.pop_front();
+            auto start = Clock::now();
+            double wait_ms = std::chrono::duration<double, std::milli>(start - j->queued).count();
+            counters.total_wait_ms += wait_ms;
+            counters.max_wait_ms = std::max(counters.max_wait_ms, wait_ms);
+            lock.unlock();
+
+            std::exception_ptr error;
+            try
+            {
+                (*j->fn)();
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+
+            lock.lock();
+            counters.jobs++;
+            counters.total_run_ms += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            j->error = error;
+            j->done = true;
+            j->finished.notify_one(); // under the lock: j is gone as soon as its thread sees done.
+        }
+    }
+
+    size_t max_queued;
+    std::mutex m;
+    std::condition_variable cv; // signals the workers.
+    std::deque<Job*> queue;
+    std::deque<std::function<void()>> helpers; // of parallel_for calls, not counted as jobs.
+    size_t idle = 0; // threads waiting for work.
+    bool stopping = false;
+    Stats counters;
+    std::vector<std::thread> workers;
+};
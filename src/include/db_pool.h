@@ -0,0 +1,143 @@
+// Pool of persistent (keep-alive) HTTP connections from the server to the database process.
+// A single httplib::Client serializes its requests on one socket, so the server keeps several
+// clients and hands one out per request. A handler checks a connection out, uses it and gives it
+// back when the Lease goes out of scope. If all connections are busy, checkout() waits.
+//
+// A connection that has been idle for longer than the health check interval is checked with
+// GET /health before it is handed out; if that fails it is replaced by a fresh connection.
+//
+// Note: the database's httplib server keeps one worker thread per open keep-alive connection,
+// so the pool must be smaller than the database's thread pool.
+#pragma once
+
+#include "httplib.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class DbPool
+{
+public:
+    struct Stats
+    {
+        size_t size = 0, idle = 0;
+        size_t checkouts = 0; // number of leases handed out.
+        size_t waited = 0; // checkouts that found no idle connection.
+        double total_wait_ms = 0, max_wait_ms = 0;
+        size_t health_checks = 0, reconnects = 0;
+    };
+
+    DbPool(const std::string& address, size_t size, std::chrono::milliseconds health_check_interval)
+        : address(address), health_check_interval(health_check_interval)
+    {
+        size = std::max(size, (size_t)1);
+        for (size_t i = 0; i < size; i++)
+            all.emplace_back(new Connection(new_client()));
+        for (auto& c : all)
+            idle.push_back(c.get());
+    }
+
+    DbPool(const DbPool&) = delete;
+    DbPool& operator=(const DbPool&) = delete;
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Connection
+    {
+        explicit Connection(httplib::Client* cli) : cli(cli), last_used(Clock::now()) {}
+        std::unique_ptr<httplib::Client> cli;
+        Clock::time_point last_used;
+    };
+
+    class Lease
+    {
+    public:
+        Lease(DbPool& pool, Connection* c) : pool(pool), c(c) {}
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        ~Lease() { pool.release(c); }
+        httplib::Client* operator->() const { return c->cli.get(); }
+
+    private:
+        DbPool& pool;
+        Connection* c;
+    };
+
+    Lease checkout()
+    {
+        auto start = Clock::now();
+        Connection* c;
+        {
+            std::unique_lock<std::mutex> lock(m);
+            counters.checkouts++;
+            if (idle.empty())
+                counters.waited++;
+            cv.wait(lock, [&] { return !idle.empty(); });
+            c = idle.back(); // most recently used first, so rarely used connections age out.
+            idle.pop_back();
+
+            double wait_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            counters.total_wait_ms += wait_ms;
+            counters.max_wait_ms = std::max(counters.max_wait_ms, wait_ms);
+        }
+
+        if (Clock::now() - c->last_used > health_check_interval)
+            check_health(*c);
+        return Lease(*this, c);
+    }
+
+    Stats stats()
+    {
+        std::lock_guard<std::mutex> lock(m);
+        Stats s = counters;
+        s.size = all.size();
+        s.idle = idle.size();
+        return s;
+    }
+
+private:
+    httplib::Client* new_client()
+    {
+        httplib::Client* cli = new httplib::Client(address);
+        cli->set_keep_alive(true);
+        return cli;
+    }
+
+    // Called without the lock, on a connection that is checked out.
+    void check_health(Connection& c)
+    {
+        auto res = c.cli->Get("/health");
+        bool healthy = res && res->status == 200;
+        if (!healthy)
+            c.cli.reset(new_client()); // drop the socket, the next request reconnects.
+
+        std::lock_guard<std::mutex> lock(m);
+        counters.health_checks++;
+        if (!healthy)
+            counters.reconnects++;
+    }
+
+    void release(Connection* c)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            c->last_used = Clock::now();
+            idle.push_back(c);
+        }
+        cv.notify_one();
+    }
+
+    std::string address;
+    std::chrono::milliseconds health_check_interval;
+    std::mutex m;
+    std::condition_variable cv;
+    std::vector<std::unique_ptr<Connection>> all;
+    std::vector<Connection*> idle;
+    Stats counters;
+};
@@ -0,0 +1,484 @@
+// Disk I/O of the embedded storage engine (reads of values, appends, syncs) through io_uring, so
+// that reads and writes issued at the same time by many httplib worker threads reach the kernel
+// together instead of as one system call each.
+//
+// An operation is queued into the submission ring and handed to the kernel by whichever caller
+// gets to submit first: everything queued until then goes with one io_uring_enter. A completion
+// thread waits for results and calls the done callback of each operation; what those callbacks
+// queue is submitted at once after them. Reads into one of the
+// buffers of buffer() use IORING_OP_READ_FIXED: those buffers are registered with the kernel once,
+// so it does not have to map their pages for every read.
+//
+// The bitcask engine uses the blocking versions (read_all, write_all, sync): each request still
+// keeps its httplib worker thread waiting for the result, which is why that engine runs on the
+// threads front end. What io_uring saves is system calls, not threads.
+//
+// If io_uring cannot be set up (an old kernel, or a sandbox that blocks it) or is not wanted, the
+// same operations run as plain pread/pwritev/fdatasync on a pool of threads.
+//
+// The ring is driven with the raw system calls and the definitions of <linux/io_uring.h>, so no
+// library (liburing) is needed.
+#pragma once
+
+#include <linux/io_uring.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+class DiskIO
+{
+public:
+    struct Stats
+    {
+        size_t ops = 0; // operations completed.
+        size_t submits = 0, max_batch = 0; // io_uring_enter calls that submitted, and the most operations in one.
+        size_t fixed_reads = 0; // reads into registered buffers.
+        size_t buffer_misses = 0; // buffer() calls that found no free buffer.
+    };
+
+    // Called with the result of an operation: bytes transferred, or -errno.
+    using Done = std::function<void(int)>;
+
+    // Uses io_uring if use_uring and the kernel allows it, else threads threads. queue_depth bounds
+    // the operations in the ring at once. buffers buffers of buffer_size bytes each are handed out
+    // by buffer().
+    DiskIO(bool use_uring, unsigned queue_depth, size_t buffers, size_t buffer_size, size_t threads)
+        : depth(std::max(queue_depth, 1u)),
+          buffer_bytes((buffer_size + 4095) / 4096 * 4096), // page aligned, so they work with O_DIRECT.
+          buffer_count(buffer_size > 0 ? buffers : 0)
+    {
+        if (buffer_count > 0)
+        {
+            buffer_base = (char*)aligned_alloc(4096, buffer_count * buffer_bytes);
+            for (size_t i = 0; i < buffer_count; i++)
+                free_buffers.push_back(buffer_base + i * buffer_bytes);
+        }
+
+        if (use_uring && setup_ring())
+        {
+            std::vector<iovec> regions;
+            for (size_t i = 0; i < buffer_count; i++)
+                regions.push_back({buffer_base + i * buffer_bytes, buffer_bytes});
+            // Locked memory limits can refuse this; the buffers then still work for plain reads.
+            registered = !regions.empty() &&
+                         syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, regions.data(), regions.size()) == 0;
+            completer = std::thread([this] { complete(); });
+        }
+        else
+        {
+            for (size_t i = 0; i < std::max(threads, (size_t)1); i++)
+                workers.emplace_back([this] { work(); });
+        }
+    }
+
+    DiskIO(const DiskIO&) = delete;
+    DiskIO& operator=(const DiskIO&) = delete;
+
+    // Waits until the operations queued, and those their done callbacks queue, have completed,
+    // then stops the threads.
+    ~DiskIO()
+    {
+        if (ring_fd >= 0)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m);
+                ring_cv.wait(lock, [&] { return pending == 0; });
+            }
+            queue([](io_uring_sqe* sqe) { sqe->opcode = IORING_OP_NOP; }, nullptr); // null done: stop.
+            completer.join();
+            munmap(sq_ptr, sq_map_bytes);
+            if (cq_ptr != sq_ptr)
+                munmap(cq_ptr, cq_map_bytes);
+            munmap(sqes, depth * sizeof(io_uring_sqe));
+            close(ring_fd);
+        }
+        else
+        {
+            {
+                std::lock_guard<std::mutex> lock(m);
+                stopping = true;
+            }
+            cv.notify_all();
+            for (auto& t : workers)
+                t.join();
+        }
+        free(buffer_base);
+    }
+
+    const char* backend() const { return ring_fd >= 0 ? (registered ? "io_uring, registered buffers" : "io_uring") : "threads"; }
+
+    // A buffer of at least n bytes that is returned when the last copy of the pointer is gone, or
+    // null if n is too large or all are in use.
+    std::shared_ptr<char> buffer(size_t n)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        if (n > buffer_bytes || free_buffers.empty())
+        {
+            if (buffer_count > 0)
+                counters.buffer_misses++;
+            return nullptr;
+        }
+        char* b = free_buffers.back();
+        free_buffers.pop_back();
+        return std::shared_ptr<char>(b, [this](char* b) {
+            std::lock_guard<std::mutex> lock(m);
+            free_buffers.push_back(b);
+        });
+    }
+
+    // Asynchronous operations. done is called on an I/O thread once the operation is complete; it
+    // must not block. buf / parts must stay valid until then. Like pread and pwritev, a read or
+    // write may transfer less than asked.
+    void read(int fd, char* buf, size_t n, uint64_t offset, Done done)
+    {
+        if (ring_fd < 0)
+            return run([=] { return ret(pread(fd, buf, n, offset)); }, std::move(done));
+        bool fixed = registered && buf >= buffer_base && buf + n <= buffer_base + buffer_count * buffer_bytes;
+        queue([&](io_uring_sqe* sqe) {
+            sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)buf;
+            sqe->len = n;
+            sqe->off = offset;
+            if (fixed)
+                sqe->buf_index = (buf - buffer_base) / buffer_bytes;
+        }, std::move(done), fixed);
+    }
+
+    void writev(int fd, const iovec* parts, int count, uint64_t offset, Done done)
+    {
+        if (ring_fd < 0)
+            return run([=] { return ret(pwritev(fd, parts, count, offset)); }, std::move(done));
+        queue([&](io_uring_sqe* sqe) {
+            sqe->opcode = IORING_OP_WRITEV;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)parts;
+            sqe->len = count;
+            sqe->off = offset;
+        }, std::move(done));
+    }
+
+    // fdatasync.
+    void sync(int fd, Done done)
+    {
+        if (ring_fd < 0)
+            return run([=] { return fdatasync(fd) == 0 ? 0 : -errno; }, std::move(done));
+        queue([&](io_uring_sqe* sqe) {
+            sqe->opcode = IORING_OP_FSYNC;
+            sqe->fd = fd;
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        }, std::move(done));
+    }
+
+    // Blocking versions for the calling thread. They transfer all n bytes (false on an error or
+    // end of file, with errno set).
+    bool read_all(int fd, char* buf, size_t n, uint64_t offset)
+    {
+        while (n > 0)
+        {
+            int r = wait([&](Done done) { read(fd, buf, n, offset, std::move(done)); });
+            if (r == -EINTR || r == -EAGAIN)
+                continue;
+            if (r <= 0)
+            {
+                errno = r < 0 ? -r : ENODATA;
+                return false;
+            }
+            buf += r;
+            n -= r;
+            offset += r;
+        }
+        return true;
+    }
+
+    // Changes parts while it goes.
+    bool write_all(int fd, iovec* parts, int count, uint64_t offset)
+    {
+        while (count > 0)
+        {
+            int w = wait([&](Done done) { writev(fd, parts, count, offset, std::move(done)); });
+            if (w == -EINTR || w == -EAGAIN)
+                continue;
+            if (w < 0)
+            {
+                errno = -w;
+                return false;
+            }
+            offset += w;
+            // Skip what was written.
+            while (count > 0 && (size_t)w >= parts->iov_len)
+            {
+                w -= parts->iov_len;
+                parts++;
+                count--;
+            }
+            if (count > 0)
+            {
+                parts->iov_base = (char*)parts->iov_base + w;
+                parts->iov_len -= w;
+            }
+        }
+        return true;
+    }
+
+    bool sync(int fd)
+    {
+        int r = wait([&](Done done) { sync(fd, std::move(done)); });
+        if (r < 0)
+            errno = -r;
+        return r == 0;
+    }
+
+    Stats stats()
+    {
+        std::lock_guard<std::mutex> lock(m);
+        return counters;
+    }
+
+private:
+    static int ret(ssize_t r) { return r < 0 ? -errno : (int)r; }
+
+    static int wait(const std::function<void(Done)>& start)
+    {
+        // Shared with the callback, which may still be inside set_value when the waiter wakes up.
+        auto result = std::make_shared<std::promise<int>>();
+        std::future<int> f = result->get_future();
+        start([result](int r) { result->set_value(r); });
+        return f.get();
+    }
+
+    bool setup_ring()
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = 2 * depth; // never less than the operations in flight, so no completion is lost.
+        int fd = syscall(__NR_io_uring_setup, depth, &p);
+        if (fd < 0)
+        {
+            std::cerr << "io_uring is not available (" << strerror(errno) << "), using threads for disk I/O\n";
+            return false;
+        }
+        depth = p.sq_entries; // rounded up to a power of 2.
+
+        sq_map_bytes = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+        cq_map_bytes = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+            sq_map_bytes = cq_map_bytes = std::max(sq_map_bytes, cq_map_bytes);
+        sq_ptr = mmap(nullptr, sq_map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        cq_ptr = (p.features & IORING_FEAT_SINGLE_MMAP)
+                     ? sq_ptr
+                     : mmap(nullptr, cq_map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqes = (io_uring_sqe*)mmap(nullptr, p.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || sqes == MAP_FAILED)
+        {
+            std::cerr << "Could not map the io_uring rings (" << strerror(errno) << "), using threads for disk I/O\n";
+            close(fd);
+            return false;
+        }
+
+        char* sq = (char*)sq_ptr;
+        sq_tail = (unsigned*)(sq + p.sq_off.tail);
+        sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+        sq_array = (unsigned*)(sq + p.sq_off.array);
+        char* cq = (char*)cq_ptr;
+        cq_head = (unsigned*)(cq + p.cq_off.head);
+        cq_tail = (unsigned*)(cq + p.cq_off.tail);
+        cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+        ring_fd = fd;
+        return true;
+    }
+
+    // Puts one operation into the submission ring, then submits.
+    void queue(const std::function<void(io_uring_sqe*)>& fill, Done done, bool fixed = false)
+    {
+        Done* op = done ? new Done(std::move(done)) : nullptr;
+        {
+            std::unique_lock<std::mutex> lock(m);
+            // Every slot of the ring is free again once its operation completed.
+            ring_cv.wait(lock, [&] { return in_flight < depth; });
+            in_flight++;
+            if (op)
+                pending++;
+            if (fixed)
+                counters.fixed_reads++;
+            unsigned tail = *sq_tail, index = tail & sq_mask;
+            io_uring_sqe* sqe = &sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            fill(sqe);
+            sqe->user_data = (uint64_t)op;
+            sq_array[index] = index;
+            __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+            unsubmitted++;
+        }
+        // Operations queued by done callbacks are submitted together after the callbacks ran.
+        if (std::this_thread::get_id() != completer.get_id())
+            submit();
+    }
+
+    // Hands everything queued so far to the kernel. While one caller does, the operations queued by
+    // others meanwhile wait and go with the next call, usually that of the one that queued them.
+    void submit()
+    {
+        std::lock_guard<std::mutex> submitting(submit_m);
+        unsigned n;
+        {
+            std::lock_guard<std::mutex> lock(m);
+            n = unsubmitted;
+            unsubmitted = 0;
+            if (n > 0)
+            {
+                counters.submits++;
+                counters.max_batch = std::max(counters.max_batch, (size_t)n);
+            }
+        }
+        while (n > 0)
+        {
+            int r = syscall(__NR_io_uring_enter, ring_fd, n, 0, 0, nullptr, 0);
+            if (r < 0)
+            {
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+                std::cerr << "io_uring_enter failed: " << strerror(errno) << "\n";
+                exit(1); // the operations are queued in the ring and would wait forever.
+            }
+            n -= r;
+        }
+    }
+
+    // The completion thread.
+    void complete()
+    {
+        std::vector<std::pair<Done*, int>> done;
+        while (true)
+        {
+            int r = syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (r < 0 && errno != EINTR)
+            {
+                std::cerr << "io_uring_enter failed: " << strerror(errno) << "\n";
+                exit(1);
+            }
+
+            unsigned head = *cq_head, tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+            for (; head != tail; head++)
+            {
+                io_uring_cqe* cqe = &cqes[head & cq_mask];
+                done.push_back({(Done*)cqe->user_data, cqe->res});
+            }
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+            if (done.empty())
+                continue;
+            {
+                std::lock_guard<std::mutex> lock(m);
+                in_flight -= done.size();
+                counters.ops += done.size();
+            }
+            ring_cv.notify_all();
+
+            bool stop = false;
+            for (auto& d : done)
+            {
+                if (!d.first)
+                {
+                    stop = true;
+                    continue;
+                }
+                (*d.first)(d.second);
+                delete d.first;
+                std::lock_guard<std::mutex> lock(m);
+                pending--;
+            }
+            if (!stop)
+                ring_cv.notify_all();
+            done.clear();
+            if (stop)
+                return;
+            submit();
+        }
+    }
+
+    // Thread pool version of an operation.
+    void run(std::function<int()> op, Done done)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            jobs.push_back({std::move(op), std::move(done)});
+        }
+        cv.notify_one();
+    }
+
+    void work()
+    {
+        while (true)
+        {
+            std::pair<std::function<int()>, Done> job;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&] { return stopping || !jobs.empty(); });
+                if (jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            int r = job.first();
+            {
+                std::lock_guard<std::mutex> lock(m);
+                counters.ops++;
+            }
+            job.second(r);
+        }
+    }
+
+    unsigned depth;
+    size_t buffer_bytes;
+    size_t buffer_count;
+    char* buffer_base = nullptr;
+    bool registered = false;
+
+    // The ring. Only set up if io_uring is used.
+    int ring_fd = -1;
+    void *sq_ptr = nullptr, *cq_ptr = nullptr;
+    size_t sq_map_bytes = 0, cq_map_bytes = 0;
+    io_uring_sqe* sqes = nullptr;
+    unsigned *sq_tail = nullptr, *sq_array = nullptr, sq_mask = 0;
+    unsigned *cq_head = nullptr, *cq_tail = nullptr, cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+    std::thread completer;
+    std::mutex submit_m; // held by the caller that submits.
+
+    std::mutex m; // guards everything below.
+    std::condition_variable ring_cv; // a slot of the ring became free, or done callbacks returned.
+    unsigned in_flight = 0, unsubmitted = 0;
+    unsigned pending = 0; // operations with a done callback that has not returned yet.
+    std::vector<char*> free_buffers;
+    Stats counters;
+
+    // The thread pool, if io_uring is not used.
+    std::condition_variable cv;
+    std::deque<std::pair<std::function<int()>, Done>> jobs;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
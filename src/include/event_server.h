@@ -0,0 +1,415 @@
+// Event-driven HTTP/1.1 front end of the database: one thread runs an epoll loop over all
+// connections, reads and parses the requests (with httplib's parsers, into an httplib::Request) and
+// hands each to its handler together with a Respond callback. The handler returns at once; the
+// answer can come later from any thread, e.g. a Cassandra driver callback, and is passed back to
+// the loop through an eventfd, which writes it. So a request holds no thread while its queries
+// run, and the requests in flight are only bounded by the connections.
+//
+// Only what the server and the load generator send is supported: keep-alive connections with one
+// request at a time, bodies with a Content-Length (no chunked uploads), multipart/form-data and
+// urlencoded forms. An image answer is written straight from the engine's buffers with sendmsg.
+#pragma once
+
+#include "httplib.h"
+#include "storage_engine.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class EventServer
+{
+public:
+    struct Answer
+    {
+        Answer(int status = 200, std::string content_type = "text/plain", std::string body = "", std::vector<Blob> parts = {})
+            : status(status), content_type(std::move(content_type)), body(std::move(body)), parts(std::move(parts))
+        {
+        }
+
+        int status;
+        std::string content_type;
+        std::string body;
+        std::vector<Blob> parts; // sent after body, without copying them.
+    };
+
+    // Called exactly once per request, on any thread. The request stays valid until then.
+    using Respond = std::function<void(Answer)>;
+    // Runs on the loop thread, so it must not wait.
+    using Handler = std::function<void(const httplib::Request&, Respond)>;
+
+    EventServer() = default;
+    EventServer(const EventServer&) = delete;
+    EventServer& operator=(const EventServer&) = delete;
+
+    void Get(const std::string& path, Handler handler) { handlers[{"GET", path}] = std::move(handler); }
+    void Post(const std::string& path, Handler handler) { handlers[{"POST", path}] = std::move(handler); }
+
+    // Serves requests on this thread. Returns false if it cannot listen.
+    bool listen(const char* host, int port)
+    {
+        int listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        int yes = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)); // as httplib, which can then listen after it.
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, host, &addr.sin_addr);
+        if (listener < 0 || bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(listener, SOMAXCONN) != 0)
+        {
+            perror("listen");
+            return false;
+        }
+
+        epoll = epoll_create1(0);
+        wakeup = eventfd(0, EFD_NONBLOCK);
+        watch(listener, EPOLLIN, &listener);
+        watch(wakeup, EPOLLIN, &wakeup);
+
+        epoll_event events[MAX_EVENTS];
+        while (true)
+        {
+            int n = epoll_wait(epoll, events, MAX_EVENTS, -1);
+            for (int i = 0; i < n; i++)
+            {
+                if (events[i].data.ptr == &listener)
+                    accept_all(listener);
+                else if (events[i].data.ptr == &wakeup)
+                    send_answers();
+                else
+                {
+                    Connection* c = static_cast<Connection*>(events[i].data.ptr);
+                    if (c->fd >= 0 && (events[i].events & EPOLLOUT))
+                        write_out(*c);
+                    if (c->fd >= 0 && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                        read_in(*c);
+                }
+            }
+            closed.clear(); // later events of this batch may still have pointed to them.
+        }
+    }
+
+private:
+    static const int MAX_EVENTS = 256;
+    static const size_t READ_BYTES = 64 << 10;
+    static const size_t MAX_IOVECS = 64;
+    static const size_t MAX_HEADER_BYTES = CPPHTTPLIB_HEADER_MAX_LENGTH;
+    static const size_t MAX_HEADERS = CPPHTTPLIB_HEADER_MAX_COUNT;
+
+    struct Connection
+    {
+        int fd;
+        std::string in; // read but not parsed yet.
+
+        // The request being read, or answered if busy.
+        httplib::Request req;
+        bool have_head = false, busy = false, close_after = false;
+        size_t body_left = 0;
+        std::unique_ptr<httplib::detail::FormDataParser> multipart;
+        httplib::FormFiles::iterator file;
+        httplib::FormFields::iterator field;
+        bool in_file = false;
+
+        // The answer being written.
+        std::string head;
+        Answer answer;
+        size_t sent = 0, total = 0;
+        bool want_out = false;
+    };
+
+    void watch(int fd, uint32_t events, void* ptr)
+    {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.ptr = ptr;
+        epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    void accept_all(int listener)
+    {
+        int fd;
+        while ((fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+        {
+            int yes = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+            auto c = std::make_shared<Connection>();
+            c->fd = fd;
+            connections[fd] = c;
+            watch(fd, EPOLLIN, c.get());
+        }
+    }
+
+    // Drops the connection. A handler still running answers into the void.
+    void close_connection(Connection& c)
+    {
+        auto it = connections.find(c.fd);
+        epoll_ctl(epoll, EPOLL_CTL_DEL, c.fd, nullptr);
+        close(c.fd);
+        c.fd = -1;
+        closed.push_back(std::move(it->second));
+        connections.erase(it);
+    }
+
+    void read_in(Connection& c)
+    {
+        char buf[READ_BYTES];
+        ssize_t n = read(c.fd, buf, sizeof(buf));
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+            return;
+        if (n <= 0)
+            return close_connection(c);
+        c.in.append(buf, n);
+        if (c.busy)
+        {
+            // Clients wait for the answer before they send the next request.
+            if (c.in.size() > MAX_HEADER_BYTES)
+                close_connection(c);
+            return;
+        }
+        parse(c);
+    }
+
+    // Parses as much of c.in as possible, and starts the request once it is complete.
+    void parse(Connection& c)
+    {
+        if (!c.have_head)
+        {
+            size_t end = c.in.find("\r\n\r\n");
+            if (end == std::string::npos)
+            {
+                if (c.in.size() > MAX_HEADER_BYTES)
+                    fail(c, 431);
+                return;
+            }
+            if (!parse_head(c, end + 2))
+                return fail(c, 400);
+            c.in.erase(0, end + 4);
+            c.have_head = true;
+            if (c.req.has_header("Transfer-Encoding"))
+                return fail(c, 501);
+            c.body_left = std::strtoull(c.req.get_header_value("Content-Length", "0").c_str(), nullptr, 10);
+            if (c.req.is_multipart_form_data())
+            {
+                std::string boundary;
+                if (!httplib::detail::parse_multipart_boundary(c.req.get_header_value("Content-Type"), boundary))
+                    return fail(c, 400);
+                c.multipart.reset(new httplib::detail::FormDataParser);
+                c.multipart->set_boundary(std::move(boundary));
+            }
+        }
+
+        size_t n = std::min(c.body_left, c.in.size());
+        if (n > 0)
+        {
+            if (!read_body(c, c.in.data(), n))
+                return fail(c, 400);
+            c.in.erase(0, n);
+            c.body_left -= n;
+        }
+        if (c.body_left > 0)
+            return;
+
+        if (c.multipart && !c.multipart->is_valid())
+            return fail(c, 400);
+        if (c.req.get_header_value("Content-Type").find("application/x-www-form-urlencoded") == 0)
+            httplib::detail::parse_query_text(c.req.body, c.req.params);
+        start(c);
+    }
+
+    bool parse_head(Connection& c, size_t end)
+    {
+        size_t line_end = c.in.find("\r\n");
+        std::string line = c.in.substr(0, line_end);
+        size_t sp1 = line.find(' '), sp2 = line.rfind(' ');
+        if (sp1 == std::string::npos || sp1 == sp2)
+            return false;
+        c.req.method = line.substr(0, sp1);
+        c.req.target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+        c.req.version = line.substr(sp2 + 1);
+        size_t q = c.req.target.find('?');
+        c.req.path = httplib::decode_path_component(c.req.target.substr(0, q));
+        if (q != std::string::npos)
+            httplib::detail::parse_query_text(c.req.target.data() + q + 1, c.req.target.size() - q - 1, c.req.params);
+
+        for (size_t begin = line_end + 2; begin < end;)
+        {
+            size_t next = c.in.find("\r\n", begin);
+            if (c.req.headers.size() == MAX_HEADERS ||
+                !httplib::detail::parse_header(c.in.data() + begin, c.in.data() + next,
+                                               [&](const std::string& key, const std::string& value) {
+                                                   c.req.headers.emplace(key, value);
+                                               }))
+                return false;
+            begin = next + 2;
+        }
+        return true;
+    }
+
+    // As httplib's server: files go to req.form.files, other parts to req.form.fields.
+    bool read_body(Connection& c, const char* data, size_t n)
+    {
+        if (!c.multipart)
+        {
+            c.req.body.append(data, n);
+            return true;
+        }
+        return c.multipart->parse(data, n,
+            [&](const httplib::FormData& part) {
+                c.in_file = !part.filename.empty();
+                if (c.in_file)
+                    c.file = c.req.form.files.emplace(part.name, part);
+                else
+                    c.field = c.req.form.fields.emplace(part.name, httplib::FormField{part.name, part.content, part.headers});
+                return true;
+            },
+            [&](const char* buf, size_t len) {
+                (c.in_file ? c.file->second.content : c.field->second.content).append(buf, len);
+                return true;
+            });
+    }
+
+    void start(Connection& c)
+    {
+        c.busy = true;
+        std::string connection = c.req.get_header_value("Connection");
+        c.close_after = connection == "close" || (c.req.version == "HTTP/1.0" && connection != "Keep-Alive");
+        auto it = handlers.find({c.req.method, c.req.path});
+        if (it == handlers.end())
+            return answer(connections[c.fd], Answer{404, "text/plain", "", {}});
+
+        std::shared_ptr<Connection> conn = connections[c.fd];
+        it->second(c.req, [this, conn](Answer a) { answer(conn, std::move(a)); });
+    }
+
+    void fail(Connection& c, int status)
+    {
+        c.busy = true;
+        c.close_after = true;
+        answer(connections[c.fd], Answer{status, "text/plain", "", {}});
+    }
+
+    // Queues the answer for the loop thread.
+    void answer(const std::shared_ptr<Connection>& c, Answer a)
+    {
+        {
+            std::lock_guard<std::mutex> lock(answers_m);
+            answers.emplace_back(c, std::move(a));
+        }
+        uint64_t one = 1;
+        ssize_t ignored = write(wakeup, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    void send_answers()
+    {
+        uint64_t count;
+        ssize_t ignored = read(wakeup, &count, sizeof(count));
+        (void)ignored;
+        std::vector<std::pair<std::shared_ptr<Connection>, Answer>> ready;
+        {
+            std::lock_guard<std::mutex> lock(answers_m);
+            ready.swap(answers);
+        }
+        for (auto& r : ready)
+        {
+            Connection& c = *r.first;
+            if (c.fd < 0)
+                continue;
+            c.answer = std::move(r.second);
+            size_t length = c.answer.body.size();
+            for (const Blob& part : c.answer.parts)
+                length += part.size;
+            c.head = "HTTP/1.1 " + std::to_string(c.answer.status) + " " + httplib::status_message(c.answer.status) +
+                     "\r\nContent-Type: " + c.answer.content_type + "\r\nContent-Length: " + std::to_string(length) +
+                     (c.close_after ? "\r\nConnection: close\r\n\r\n" : "\r\n\r\n");
+            c.sent = 0;
+            c.total = c.head.size() + length;
+            write_out(c);
+        }
+    }
+
+    // Writes what is left of the answer, and goes on with the next request once it is out.
+    void write_out(Connection& c)
+    {
+        while (c.sent < c.total)
+        {
+            iovec iov[MAX_IOVECS];
+            size_t count = 0, skip = c.sent;
+            auto add = [&](const char* data, size_t size) {
+                if (skip >= size)
+                {
+                    skip -= size;
+                    return;
+                }
+                if (count < MAX_IOVECS)
+                    iov[count++] = {const_cast<char*>(data) + skip, size - skip};
+                skip = 0;
+            };
+            add(c.head.data(), c.head.size());
+            add(c.answer.body.data(), c.answer.body.size());
+            for (const Blob& part : c.answer.parts)
+                add(part.data, part.size);
+
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+            ssize_t n = sendmsg(c.fd, &msg, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && errno == EAGAIN)
+                return want_out(c, true);
+            if (n < 0)
+                return close_connection(c);
+            c.sent += n;
+        }
+
+        want_out(c, false);
+        if (c.close_after)
+            return close_connection(c);
+        c.answer = Answer();
+        c.head.clear();
+        c.req = httplib::Request();
+        c.multipart.reset();
+        c.have_head = c.busy = false;
+        parse(c);
+    }
+
+    void want_out(Connection& c, bool want)
+    {
+        if (c.want_out == want)
+            return;
+        c.want_out = want;
+        epoll_event ev{};
+        ev.events = want ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        ev.data.ptr = &c;
+        epoll_ctl(epoll, EPOLL_CTL_MOD, c.fd, &ev);
+    }
+
+    std::map<std::pair<std::string, std::string>, Handler> handlers; // by method and path.
+    int epoll = -1, wakeup = -1;
+    std::unordered_map<int, std::shared_ptr<Connection>> connections; // by fd. Only used by the loop.
+    std::vector<std::shared_ptr<Connection>> closed;
+
+    std::mutex answers_m;
+    std::vector<std::pair<std::shared_ptr<Connection>, Answer>> answers; // for the loop to send.
+};
@@ -0,0 +1,476 @@
+// Eviction policies for the server cache (see cache.h).
+// Each cache shard owns one policy object. The shard calls it with its lock held, so the
+// policies themselves are not thread-safe.
+//
+// Policies do not keep their own index of keys. Every cache entry carries a PolicyHook, and the
+// policies link the entries themselves into intrusive lists through it. So inserting, hitting,
+// erasing (e.g. on /delete) and evicting an entry are all O(1) pointer updates, without any
+// search for the key.
+//
+//   fifo      keys are evicted in the order they arrived (the original policy of the server).
+//   lru       least recently used key is evicted. A hit moves the key to the front.
+//   clock     approximation of lru: a hit only sets a reference bit, the hand clears it once
+//             before evicting the key.
+//   s3fifo    small FIFO queue (10%) for new keys, main FIFO queue (90%) for keys that were hit
+//             while in the small queue, and a ghost queue remembering keys recently evicted
+//             from the small queue. One-off keys leave quickly without disturbing the main queue.
+//   wtinylfu  small LRU window (1%) in front of a segmented LRU main area. A key leaving the
+//             window only enters the main area if its estimated access frequency (count-min
+//             sketch) is higher than that of the main area's next victim.
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct CacheEntry;
+
+// Cached values are immutable and shared. A reader takes a reference instead of a copy, so the
+// value stays alive until its last reader is done, even if it is evicted in the meantime.
+using CacheValue = std::shared_ptr<const std::string>;
+
+// Per-entry state owned by the eviction policy.
+struct PolicyHook
+{
+    CacheEntry* prev = nullptr;
+    CacheEntry* next = nullptr;
+    uint8_t segment = 0; // which of the policy's lists the entry is in.
+    uint8_t freq = 0; // s3fifo: hits since the entry entered its queue.
+    bool referenced = false; // clock: reference bit.
+};
+
+struct CacheEntry
+{
+    const std::string* key = nullptr; // points to the key stored in the shard's hash-map.
+    CacheValue value;
+    size_t charge = 0; // bytes charged to the shard's budget for this entry.
+    PolicyHook hook;
+};
+
+// Doubly-linked list threaded through PolicyHook. Entries are pushed to the front and the
+// oldest one is at the back. Also sums the charges of its entries.
+class EntryList
+{
+public:
+    bool empty() const { return head == nullptr; }
+    size_t size() const { return count; }
+    size_t bytes() const { return total_bytes; }
+    CacheEntry* front() const { return head; }
+    CacheEntry* back() const { return tail; }
+
+    void push_front(CacheEntry* e)
+    {
+        e->hook.prev = nullptr;
+        e->hook.next = head;
+        if (head)
+            head->hook.prev = e;
+        else
+            tail = e;
+        head = e;
+        count++;
+        total_bytes += e->charge;
+    }
+
+    void remove(CacheEntry* e)
+    {
+        if (e->hook.prev)
+            e->hook.prev->hook.next = e->hook.next;
+        else
+            head = e->hook.next;
+        if (e->hook.next)
+            e->hook.next->hook.prev = e->hook.prev;
+        else
+            tail = e->hook.prev;
+        e->hook.prev = e->hook.next = nullptr;
+        count--;
+        total_bytes -= e->charge;
+    }
+
+    // Called when the charge of an entry in this list changed from old_charge to e->charge.
+    void recharge(CacheEntry* e, size_t old_charge) { total_bytes = total_bytes - old_charge + e->charge; }
+
+private:
+    CacheEntry* head = nullptr;
+    CacheEntry* tail = nullptr;
+    size_t count = 0;
+    size_t total_bytes = 0;
+};
+
+class EvictionPolicy
+{
+public:
+    virtual ~EvictionPolicy() = default;
+
+    // A new entry was stored in the shard.
+    virtual void on_insert(CacheEntry* e) = 0;
+    // e was read from the shard.
+    virtual void on_hit(CacheEntry* e) = 0;
+    // The value of e was overwritten, its charge changed from old_charge to e->charge.
+    virtual void on_update(CacheEntry* e, size_t old_charge) = 0;
+    // e is removed from the shard for another reason than eviction (e.g. /delete).
+    virtual void on_erase(CacheEntry* e) = 0;
+    // Chooses the next entry to evict and unlinks it. Only called when the policy tracks some entry.
+    virtual CacheEntry* evict() = 0;
+};
+
+class FifoPolicy : public EvictionPolicy
+{
+public:
+    void on_insert(CacheEntry* e) override { queue_of_keys.push_front(e); }
+    void on_hit(CacheEntry*) override {}
+    void on_update(CacheEntry* e, size_t old_charge) override { queue_of_keys.recharge(e, old_charge); }
+    void on_erase(CacheEntry* e) override { queue_of_keys.remove(e); }
+    CacheEntry* evict() override
+    {
+        CacheEntry* e = queue_of_keys.back();
+        queue_of_keys.remove(e);
+        return e;
+    }
+
+private:
+    EntryList queue_of_keys; // order in which the keys arrived.
+};
+
+class LruPolicy : public EvictionPolicy
+{
+public:
+    void on_insert(CacheEntry* e) override { recency.push_front(e); }
+    void on_hit(CacheEntry* e) override
+    {
+        recency.remove(e);
+        recency.push_front(e);
+    }
+    void on_update(CacheEntry* e, size_t old_charge) override
+    {
+        recency.recharge(e, old_charge);
+        on_hit(e);
+    }
+    void on_erase(CacheEntry* e) override { recency.remove(e); }
+    CacheEntry* evict() override
+    {
+        CacheEntry* e = recency.back();
+        recency.remove(e);
+        return e;
+    }
+
+private:
+    EntryList recency; // most recently used key first.
+};
+
+class ClockPolicy : public EvictionPolicy
+{
+public:
+    // New entries go right behind the hand, so they are the last ones it reaches.
+    void on_insert(CacheEntry* e) override
+    {
+        e->hook.referenced = false;
+        if (!hand)
+        {
+            e->hook.prev = e->hook.next = e;
+            hand = e;
+            return;
+        }
+        e->hook.next = hand;
+        e->hook.prev = hand->hook.prev;
+        hand->hook.prev->hook.next = e;
+        hand->hook.prev = e;
+    }
+    void on_hit(CacheEntry* e) override { e->hook.referenced = true; }
+    void on_update(CacheEntry* e, size_t) override { on_hit(e); }
+    void on_erase(CacheEntry* e) override { unlink(e); }
+    CacheEntry* evict() override
+    {
+        while (hand->hook.referenced)
+        {
+            hand->hook.referenced = false; // second chance.
+            hand = hand->hook.next;
+        }
+        CacheEntry* e = hand;
+        unlink(e);
+        return e;
+    }
+
+private:
+    void unlink(CacheEntry* e)
+    {
+        if (e->hook.next == e)
+            hand = nullptr;
+        else
+        {
+            e->hook.prev->hook.next = e->hook.next;
+            e->hook.next->hook.prev = e->hook.prev;
+            if (hand == e)
+                hand = e->hook.next;
+        }
+        e->hook.prev = e->hook.next = nullptr;
+    }
+
+    CacheEntry* hand = nullptr; // the clock is a circular list of all entries.
+};
+
+class S3FifoPolicy : public EvictionPolicy
+{
+public:
+    explicit S3FifoPolicy(size_t capacity_bytes) : small_capacity(capacity_bytes / 10) {}
+
+    void on_insert(CacheEntry* e) override
+    {
+        e->hook.freq = 0;
+        auto g = ghost_pos.find(*e->key);
+        if (g != ghost_pos.end()) // evicted from small recently, so it goes straight to main.
+        {
+            ghost.erase(g->second);
+            ghost_pos.erase(g);
+            push(MAIN, e);
+        }
+        else
+            push(SMALL, e);
+    }
+    void on_hit(CacheEntry* e) override
+    {
+        if (e->hook.freq < 3)
+            e->hook.freq++;
+    }
+    void on_update(CacheEntry* e, size_t old_charge) override
+    {
+        queues[e->hook.segment].recharge(e, old_charge);
+        on_hit(e);
+    }
+    void on_erase(CacheEntry* e) override { queues[e->hook.segment].remove(e); }
+    CacheEntry* evict() override
+    {
+        EntryList& small = queues[SMALL];
+        EntryList& main = queues[MAIN];
+        for (;;)
+        {
+            if (!small.empty() && (small.bytes() > small_capacity || main.empty()))
+            {
+                CacheEntry* e = small.back();
+                small.remove(e);
+                if (e->hook.freq > 1) // hit at least twice while in small: keep it in main.
+                {
+                    e->hook.freq = 0;
+                    push(MAIN, e);
+                    continue;
+                }
+                remember(*e->key);
+                return e;
+            }
+
+            CacheEntry* e = main.back();
+            main.remove(e);
+            if (e->hook.freq > 0) // reinsert at the head of main with one less credit.
+            {
+                e->hook.freq--;
+                push(MAIN, e);
+                continue;
+            }
+            return e;
+        }
+    }
+
+private:
+    enum Queue { SMALL = 0, MAIN = 1 };
+
+    void push(Queue q, CacheEntry* e)
+    {
+        e->hook.segment = q;
+        queues[q].push_front(e);
+    }
+    // The ghost queue holds only keys, as many as there are keys in main (at least 64).
+    void remember(const std::string& key)
+    {
+        ghost.push_front(key);
+        ghost_pos[key] = ghost.begin();
+        size_t limit = std::max(queues[MAIN].size(), (size_t)64);
+        while (ghost.size() > limit)
+        {
+            ghost_pos.erase(ghost.back());
+            ghost.pop_back();
+        }
+    }
+
+    EntryList queues[2];
+    size_t small_capacity;
+    std::list<std::string> ghost;
+    std::unordered_map<std::string, std::list<std::string>::iterator> ghost_pos;
+};
+
+// Count-min sketch with 4 bit counters (kept in bytes for simplicity) used by W-TinyLFU to
+// estimate how often a key was accessed. All counters are halved after a number of increments,
+// so old popularity fades out.
+class FrequencySketch
+{
+public:
+    explicit FrequencySketch(size_t width)
+    {
+        size_t w = 64;
+        while (w < width)
+            w <<= 1;
+        mask = w - 1;
+        table.assign(4 * w, 0);
+        sample_size = 10 * w;
+    }
+
+    void increment(const std::string& key)
+    {
+        size_t h = std::hash<std::string>()(key);
+        for (int i = 0; i < 4; i++)
+        {
+            uint8_t& c = table[i * (mask + 1) + index(h, i)];
+            if (c < 15)
+                c++;
+        }
+        if (++additions == sample_size)
+        {
+            for (auto& c : table)
+                c >>= 1;
+            additions /= 2;
+        }
+    }
+
+    int frequency(const std::string& key) const
+    {
+        size_t h = std::hash<std::string>()(key);
+        int f = 15;
+        for (int i = 0; i < 4; i++)
+            f = std::min(f, (int)table[i * (mask + 1) + index(h, i)]);
+        return f;
+    }
+
+private:
+    size_t index(size_t h, int i) const
+    {
+        h += (size_t)(i + 1) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 32;
+        h *= 0xd6e8feb86659fd93ULL;
+        h ^= h >> 32;
+        return h & mask;
+    }
+
+    std::vector<uint8_t> table;
+    size_t mask;
+    size_t sample_size;
+    size_t additions = 0;
+};
+
+class WTinyLfuPolicy : public EvictionPolicy
+{
+public:
+    explicit WTinyLfuPolicy(size_t capacity_bytes)
+        : window_capacity(std::max(capacity_bytes / 100, (size_t)1)),
+          main_capacity(capacity_bytes - capacity_bytes / 100),
+          protected_capacity(main_capacity * 8 / 10),
+          sketch(1024)
+    {
+    }
+
+    void on_insert(CacheEntry* e) override
+    {
+        sketch.increment(*e->key);
+        push(WINDOW, e);
+    }
+    void on_hit(CacheEntry* e) override
+    {
+        sketch.increment(*e->key);
+        lists[e->hook.segment].remove(e);
+        if (e->hook.segment == WINDOW)
+        {
+            push(WINDOW, e);
+            return;
+        }
+
+        // Hits in probation or protected (re)enter protected. Its overflow goes back to probation.
+        push(PROTECTED, e);
+        while (lists[PROTECTED].bytes() > protected_capacity && lists[PROTECTED].size() > 1)
+        {
+            CacheEntry* demoted = lists[PROTECTED].back();
+            lists[PROTECTED].remove(demoted);
+            push(PROBATION, demoted);
+        }
+    }
+    void on_update(CacheEntry* e, size_t old_charge) override
+    {
+        lists[e->hook.segment].recharge(e, old_charge);
+        on_hit(e);
+    }
+    void on_erase(CacheEntry* e) override { lists[e->hook.segment].remove(e); }
+    CacheEntry* evict() override
+    {
+        // Keys leaving the window move into the main area for free while it has room.
+        while (lists[WINDOW].bytes() > window_capacity &&
+               lists[PROBATION].bytes() + lists[PROTECTED].bytes() + lists[WINDOW].back()->charge <= main_capacity)
+        {
+            CacheEntry* e = lists[WINDOW].back();
+            lists[WINDOW].remove(e);
+            push(PROBATION, e);
+        }
+
+        bool main_empty = lists[PROBATION].empty() && lists[PROTECTED].empty();
+        if (!lists[WINDOW].empty() && (lists[WINDOW].bytes() > window_capacity || main_empty))
+        {
+            // The window's LRU key is a candidate for the main area. It only gets in by
+            // pushing out a key of main that was accessed less often.
+            CacheEntry* candidate = lists[WINDOW].back();
+            lists[WINDOW].remove(candidate);
+            if (main_empty)
+                return candidate;
+
+            EntryList& s = lists[PROBATION].empty() ? lists[PROTECTED] : lists[PROBATION];
+            CacheEntry* victim = s.back();
+            if (sketch.frequency(*candidate->key) > sketch.frequency(*victim->key))
+            {
+                s.remove(victim);
+                push(PROBATION, candidate);
+                return victim;
+            }
+            return candidate;
+        }
+
+        EntryList& s = lists[PROBATION].empty() ? lists[PROTECTED] : lists[PROBATION];
+        CacheEntry* e = s.back();
+        s.remove(e);
+        return e;
+    }
+
+private:
+    enum Segment { WINDOW = 0, PROBATION = 1, PROTECTED = 2 };
+
+    // Most recently used keys are at the front of each segment.
+    void push(Segment s, CacheEntry* e)
+    {
+        e->hook.segment = s;
+        lists[s].push_front(e);
+    }
+
+    EntryList lists[3];
+    size_t window_capacity, main_capacity, protected_capacity;
+    FrequencySketch sketch;
+};
+
+inline bool is_policy_name(const std::string& name)
+{
+    return name == "fifo" || name == "lru" || name == "clock" || name == "s3fifo" || name == "wtinylfu";
+}
+
+// Returns nullptr for an unknown policy name.
+inline std::unique_ptr<EvictionPolicy> make_policy(const std::string& name, size_t capacity_bytes)
+{
+    if (name == "fifo")
+        return std::unique_ptr<EvictionPolicy>(new FifoPolicy());
+    if (name == "lru")
+        return std::unique_ptr<EvictionPolicy>(new LruPolicy());
+    if (name == "clock")
+        return std::unique_ptr<EvictionPolicy>(new ClockPolicy());
+    if (name == "s3fifo")
+        return std::unique_ptr<EvictionPolicy>(new S3FifoPolicy(capacity_bytes));
+    if (name == "wtinylfu")
+        return std::unique_ptr<EvictionPolicy>(new WTinyLfuPolicy(capacity_bytes));
+    return nullptr;
+}
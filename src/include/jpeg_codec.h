@@ -0,0 +1,208 @@
+// JPEG decoding and encoding for the rotate handlers, with libjpeg(-turbo) directly instead of
+// imdecode / imencode.
+//
+// Every thread keeps one decompressor and one compressor and reuses them for all its images, so
+// a request does not set up a codec (and its memory pools and Huffman tables) from scratch. A JPEG
+// is decoded straight into the rows of a cv::Mat of the size given by its header, as the 8 bit BGR
+// pixels imdecode(IMREAD_COLOR) returns, and the caller can pass the same Mat again to reuse its
+// pixels. An image is encoded straight into the std::string that is sent, sized up front from the
+// image size, instead of into a vector that is then copied.
+//
+// JPEGs that imdecode would decode differently (CMYK, or with Exif data, whose orientation
+// imdecode applies) are refused, and the caller falls back to OpenCV for them.
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <cstdio> // jpeglib.h needs FILE and size_t.
+#include <csetjmp>
+#include <cstring>
+#include <string>
+#include <jpeglib.h>
+
+namespace jpeg_codec
+{
+const int ROWS_PER_CALL = 16; // rows passed to one jpeg_read_scanlines / jpeg_write_scanlines.
+
+struct ErrorManager
+{
+    jpeg_error_mgr pub;
+    jmp_buf jump; // set by every operation before it calls libjpeg.
+};
+
+// libjpeg's default error handler exits the process. Return to the operation's setjmp instead.
+inline void error_exit(j_common_ptr cinfo)
+{
+    longjmp(((ErrorManager*)cinfo->err)->jump, 1);
+}
+
+inline void no_output(j_common_ptr) {} // corrupt data warnings.
+
+// Compressed data goes into a std::string, doubled whenever it is full and cut to size at the end.
+struct StringDestination
+{
+    jpeg_destination_mgr pub;
+    std::string* out;
+};
+
+inline void init_destination(j_compress_ptr cinfo)
+{
+    StringDestination* d = (StringDestination*)cinfo->dest;
+    d->out->resize(std::max(d->out->size(), (size_t)4096));
+    d->pub.next_output_byte = (JOCTET*)&(*d->out)[0];
+    d->pub.free_in_buffer = d->out->size();
+}
+
+inline boolean empty_output_buffer(j_compress_ptr cinfo)
+{
+    StringDestination* d = (StringDestination*)cinfo->dest;
+    size_t used = d->out->size(); // all of it.
+    d->out->resize(2 * used);
+    d->pub.next_output_byte = (JOCTET*)&(*d->out)[used];
+    d->pub.free_in_buffer = d->out->size() - used;
+    return TRUE;
+}
+
+inline void term_destination(j_compress_ptr cinfo)
+{
+    StringDestination* d = (StringDestination*)cinfo->dest;
+    d->out->resize(d->out->size() - d->pub.free_in_buffer);
+}
+
+// The codec objects of one thread. After an error an operation aborts them, which makes them
+// ready for the next image.
+struct Handles
+{
+    Handles()
+    {
+        decompress.err = compress.err = jpeg_std_error(&err.pub);
+        err.pub.error_exit = error_exit;
+        err.pub.output_message = no_output;
+        jpeg_create_decompress(&decompress);
+        jpeg_create_compress(&compress);
+        dest.pub.init_destination = init_destination;
+        dest.pub.empty_output_buffer = empty_output_buffer;
+        dest.pub.term_destination = term_destination;
+    }
+
+    ~Handles()
+    {
+        jpeg_destroy_compress(&compress);
+        jpeg_destroy_decompress(&decompress);
+    }
+
+    Handles(const Handles&) = delete;
+    Handles& operator=(const Handles&) = delete;
+
+    // Sets the compressor to write into out, which is grown from its current size as needed.
+    void write_to(std::string& out)
+    {
+        dest.out = &out;
+        compress.dest = &dest.pub;
+    }
+
+    ErrorManager err;
+    jpeg_decompress_struct decompress;
+    jpeg_compress_struct compress;
+    StringDestination dest;
+};
+
+inline Handles& handles()
+{
+    thread_local Handles h;
+    return h;
+}
+
+inline bool has_exif(j_decompress_ptr cinfo)
+{
+    for (jpeg_saved_marker_ptr m = cinfo->marker_list; m; m = m->next)
+        if (m->marker == JPEG_APP0 + 1 && m->data_length >= 6 && memcmp(m->data, "Exif\0\0", 6) == 0)
+            return true;
+    return false;
+}
+
+// Reads the header of the JPEG in data with the thread's decompressor (Exif markers are kept for
+// has_exif). Only after a setjmp on h.err.jump.
+inline void read_header(Handles& h, const char* data, size_t size)
+{
+    jpeg_mem_src(&h.decompress, (const unsigned char*)data, size);
+    jpeg_save_markers(&h.decompress, JPEG_APP0 + 1, 0xFFFF);
+    jpeg_read_header(&h.decompress, TRUE);
+}
+}
+
+// Decodes the JPEG in data into img as 8 bit BGR, like imdecode(IMREAD_COLOR). If img already has
+// the image's size, its pixels are overwritten, so they must not be in use elsewhere. Returns false
+// if data is not a JPEG, is corrupt, or is one that imdecode would decode differently (see above).
+inline bool decode_jpeg(const char* data, size_t size, cv::Mat& img)
+{
+    using namespace jpeg_codec;
+    if (size < 2 || (unsigned char)data[0] != 0xFF || (unsigned char)data[1] != 0xD8)
+        return false;
+    Handles& h = handles();
+    j_decompress_ptr d = &h.decompress;
+    if (setjmp(h.err.jump))
+    {
+        jpeg_abort_decompress(d);
+        return false;
+    }
+
+    read_header(h, data, size);
+    bool color = d->jpeg_color_space == JCS_GRAYSCALE || d->jpeg_color_space == JCS_YCbCr || d->jpeg_color_space == JCS_RGB;
+    if (!color || has_exif(d))
+    {
+        jpeg_abort_decompress(d);
+        return false;
+    }
+    d->out_color_space = JCS_EXT_BGR;
+    jpeg_start_decompress(d);
+    img.create(d->output_height, d->output_width, CV_8UC3);
+    JSAMPROW rows[ROWS_PER_CALL];
+    while (d->output_scanline < d->output_height)
+    {
+        int n = std::min(ROWS_PER_CALL, (int)(d->output_height - d->output_scanline));
+        for (int i = 0; i < n; i++)
+            rows[i] = img.ptr<JSAMPLE>(d->output_scanline + i);
+        jpeg_read_scanlines(d, rows, n);
+    }
+    jpeg_finish_decompress(d);
+    return true;
+}
+
+// Encodes img (8 bit BGR or grayscale) into out as a JPEG of the given quality (1..100), with
+// 4:2:0 chroma subsampling like imencode. Returns false for other types of images.
+inline bool encode_jpeg(const cv::Mat& img, int quality, std::string& out)
+{
+    using namespace jpeg_codec;
+    if (img.empty() || (img.type() != CV_8UC3 && img.type() != CV_8UC1))
+        return false;
+    Handles& h = handles();
+    j_compress_ptr c = &h.compress;
+    if (setjmp(h.err.jump))
+    {
+        jpeg_abort_compress(c);
+        return false;
+    }
+
+    c->image_width = img.cols;
+    c->image_height = img.rows;
+    c->input_components = img.channels();
+    c->in_color_space = img.channels() == 3 ? JCS_EXT_BGR : JCS_GRAYSCALE;
+    jpeg_set_defaults(c);
+    jpeg_set_quality(c, quality, TRUE);
+    // A photo at quality 95 takes about 4 bits per pixel, so this (6 for BGR) is rarely grown.
+    out.resize(img.total() * img.channels() / 4 + 4096);
+    h.write_to(out);
+    jpeg_start_compress(c, TRUE);
+    JSAMPROW rows[ROWS_PER_CALL];
+    while (c->next_scanline < c->image_height)
+    {
+        int n = std::min(ROWS_PER_CALL, (int)(c->image_height - c->next_scanline));
+        for (int i = 0; i < n; i++)
+            rows[i] = (JSAMPROW)img.ptr<JSAMPLE>(c->next_scanline + i);
+        jpeg_write_scanlines(c, rows, n);
+    }
+    jpeg_finish_compress(c);
+    return true;
+}
@@ -0,0 +1,135 @@
+// Lossless rotation of a JPEG by a multiple of 90 degrees, done on its DCT coefficients like
+// jpegtran, with libjpeg(-turbo): the image is entropy decoded into its 8x8 coefficient blocks,
+// the blocks are moved to their rotated places (and the coefficients inside each block transposed
+// and sign flipped), and the blocks are entropy coded again. There is no inverse DCT, color
+// conversion, forward DCT or quantization, so it is cheaper than decoding and encoding the pixels,
+// and the image does not lose quality however often it is rotated.
+//
+// Blocks can only be moved whole, so this needs the width and height to be multiples of the MCU
+// (8 or 16 pixels, depending on the chroma subsampling): otherwise the partial blocks at the right
+// and bottom edges would end up at the left or top. Such images, anything that is not a JPEG, and
+// JPEGs with an Exif block (which may carry an orientation that decoders apply) are left to the
+// caller's pixel path.
+#pragma once
+
+#include "jpeg_codec.h"
+
+#include <utility>
+
+namespace jpeg_rotation
+{
+// Copies the coefficient arrays of src into dst (allocated with the rotated size), rotated
+// counter-clockwise by quarter_turns. Only whole MCUs, so every component is a whole number of blocks.
+inline void rotate_coefficients(j_decompress_ptr src, jvirt_barray_ptr* src_arrays, jvirt_barray_ptr* dst_arrays,
+                                int quarter_turns)
+{
+    for (int ci = 0; ci < src->num_components; ci++)
+    {
+        jpeg_component_info* comp = &src->comp_info[ci];
+        const JDIMENSION width = comp->width_in_blocks, height = comp->height_in_blocks;
+        JBLOCKARRAY dst = (*src->mem->access_virt_barray)((j_common_ptr)src, dst_arrays[ci], 0,
+                                                           quarter_turns == 2 ? height : width, TRUE);
+        for (JDIMENSION r = 0; r < height; r++)
+        {
+            JBLOCKROW row = (*src->mem->access_virt_barray)((j_common_ptr)src, src_arrays[ci], r, 1, FALSE)[0];
+            for (JDIMENSION c = 0; c < width; c++)
+            {
+                const JCOEF* s = row[c];
+                // In frequency space a transpose swaps the row and column frequencies, and a flip
+                // negates the odd frequencies along its axis.
+                if (quarter_turns == 1) // transpose, then flip vertically.
+                {
+                    JCOEF* d = dst[width - 1 - c][r];
+                    for (int u = 0; u < DCTSIZE; u++)
+                        for (int v = 0; v < DCTSIZE; v++)
+                            d[u * DCTSIZE + v] = (u & 1) ? -s[v * DCTSIZE + u] : s[v * DCTSIZE + u];
+                }
+                else if (quarter_turns == 3) // transpose, then flip horizontally.
+                {
+                    JCOEF* d = dst[c][height - 1 - r];
+                    for (int u = 0; u < DCTSIZE; u++)
+                        for (int v = 0; v < DCTSIZE; v++)
+                            d[u * DCTSIZE + v] = (v & 1) ? -s[v * DCTSIZE + u] : s[v * DCTSIZE + u];
+                }
+                else // both flips.
+                {
+                    JCOEF* d = dst[height - 1 - r][width - 1 - c];
+                    for (int u = 0; u < DCTSIZE; u++)
+                        for (int v = 0; v < DCTSIZE; v++)
+                            d[u * DCTSIZE + v] = ((u + v) & 1) ? -s[u * DCTSIZE + v] : s[u * DCTSIZE + v];
+                }
+            }
+        }
+    }
+}
+}
+
+// Rotates the JPEG in data counter-clockwise by angle degrees, without decoding it, into out, with
+// the thread's codec objects (see jpeg_codec.h). Returns false, leaving out unspecified, if angle is
+// not a multiple of 90 or the image cannot be rotated losslessly (see above).
+inline bool rotate_jpeg(const char* data, size_t size, int angle, std::string& out)
+{
+    using namespace jpeg_codec;
+    int normalized = (angle % 360 + 360) % 360;
+    if (normalized % 90 != 0 || size < 2 || (unsigned char)data[0] != 0xFF || (unsigned char)data[1] != 0xD8)
+        return false;
+    const int quarter_turns = normalized / 90;
+
+    Handles& h = handles();
+    j_decompress_ptr src = &h.decompress;
+    j_compress_ptr dst = &h.compress;
+    if (setjmp(h.err.jump))
+    {
+        jpeg_abort_compress(dst);
+        jpeg_abort_decompress(src);
+        return false;
+    }
+
+    read_header(h, data, size);
+    if (quarter_turns == 0) // a valid JPEG is its own rotation.
+    {
+        jpeg_abort_decompress(src);
+        out.assign(data, size);
+        return true;
+    }
+    const unsigned mcu_width = src->max_h_samp_factor * DCTSIZE, mcu_height = src->max_v_samp_factor * DCTSIZE;
+    bool whole_mcus = src->image_width % mcu_width == 0 && src->image_height % mcu_height == 0;
+    if (!whole_mcus || has_exif(src))
+    {
+        jpeg_abort_decompress(src);
+        return false;
+    }
+
+    // Requested before jpeg_read_coefficients, which allocates them together with its own.
+    jvirt_barray_ptr dst_arrays[MAX_COMPONENTS];
+    for (int ci = 0; ci < src->num_components; ci++)
+    {
+        jpeg_component_info* comp = &src->comp_info[ci];
+        JDIMENSION width = comp->width_in_blocks, height = comp->height_in_blocks;
+        if (quarter_turns != 2)
+            std::swap(width, height);
+        dst_arrays[ci] = (*src->mem->request_virt_barray)((j_common_ptr)src, JPOOL_IMAGE, FALSE, width, height, height);
+    }
+    jvirt_barray_ptr* src_arrays = jpeg_read_coefficients(src);
+    jpeg_rotation::rotate_coefficients(src, src_arrays, dst_arrays, quarter_turns);
+
+    jpeg_copy_critical_parameters(src, dst);
+    if (quarter_turns != 2)
+    {
+        // The sampling factors and the quantization tables are transposed with the blocks.
+        std::swap(dst->image_width, dst->image_height);
+        for (int ci = 0; ci < dst->num_components; ci++)
+            std::swap(dst->comp_info[ci].h_samp_factor, dst->comp_info[ci].v_samp_factor);
+        for (int t = 0; t < NUM_QUANT_TBLS; t++)
+            if (JQUANT_TBL* q = dst->quant_tbl_ptrs[t])
+                for (int u = 0; u < DCTSIZE; u++)
+                    for (int v = u + 1; v < DCTSIZE; v++)
+                        std::swap(q->quantval[u * DCTSIZE + v], q->quantval[v * DCTSIZE + u]);
+    }
+    out.resize(size + size / 8 + 1024); // about the size of the original.
+    h.write_to(out);
+    jpeg_write_coefficients(dst, dst_arrays);
+    jpeg_finish_compress(dst);
+    jpeg_finish_decompress(src);
+    return true;
+}
@@ -0,0 +1,389 @@
+// Bloom filter of the keys in storage, kept by the database process, so that requests for keys that
+// do not exist are answered without a query: a key the filter does not contain is definitely not
+// stored. A key it contains usually is, except for a false positive, which costs the query that
+// would have been sent anyway.
+//
+// The filter is built at startup by scanning every key of the storage engine. A key is added
+// before it is written, so a reader never misses a key whose write completed. Deleted keys cannot
+// be removed from a Bloom filter (and a counting one would need to know whether a write replaced an
+// existing key, which Cassandra does not say), so they stay in it as false positives. Once deletes
+// since the last build reach rebuild_fraction of the keys (and at least 1000), or the filter gets
+// too full for fp_rate, it is rebuilt in the background by another scan while the old filter keeps
+// answering.
+//
+// Writes of a key hold its WriteLock: writes of the same key run one at a time, and a rebuild waits
+// for the writes in progress when it starts, so that every key written from then on is added to
+// the new filter as well, and again when it ends, to replace the old filter. A write may finish on
+// another thread than the one it started on (e.g. in a Cassandra driver callback), so the lock is
+// not a mutex: it is granted to a callback and released by whichever thread drops it.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class KeyFilter
+{
+public:
+    struct Stats
+    {
+        size_t checks = 0, definite_misses = 0; // lookups, and those answered without storage.
+        size_t false_positives = 0; // keys the filter let through that storage did not have.
+        size_t rebuilds = 0;
+        size_t bits = 0, hashes = 0, keys = 0; // of the current filter; keys found by its scan.
+        double estimated_fp_rate = 0; // from the share of bits set.
+    };
+
+    // Calls its argument with every stored key. Returns false if that failed.
+    using Scan = std::function<bool(const std::function<void(const std::string&)>&)>;
+
+    // Builds the filter with scan. If that fails, or expected_keys is 0, the filter lets every key
+    // through.
+    KeyFilter(size_t expected_keys, double fp_rate, double rebuild_fraction, Scan scan)
+        : expected_keys(expected_keys), fp_rate(fp_rate), rebuild_fraction(rebuild_fraction), scan(std::move(scan))
+    {
+        if (expected_keys > 0)
+            current = build(nullptr);
+        rebuilder = std::thread([this] { run_rebuilder(); });
+    }
+
+    KeyFilter(const KeyFilter&) = delete;
+    KeyFilter& operator=(const KeyFilter&) = delete;
+
+    // Waits for a rebuild in progress.
+    ~KeyFilter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        rebuilder.join();
+    }
+
+    // False if key is definitely not stored.
+    bool may_contain(const std::string& key)
+    {
+        std::shared_ptr<Bits> bits = std::atomic_load(&current);
+        checks++;
+        if (!bits || bits->test(hash(key)))
+            return true;
+        definite_misses++;
+        return false;
+    }
+
+    // Storage did not have a key that may_contain let through.
+    void false_positive() { false_positives++; }
+
+    // To be held while a key is written (stored or deleted). Copies share the lock, which is
+    // released, on whichever thread, when the last of them is destroyed.
+    class WriteLock
+    {
+    public:
+        WriteLock() = default;
+
+    private:
+        friend class KeyFilter;
+        explicit WriteLock(std::shared_ptr<void> held) : held(std::move(held)) {}
+        std::shared_ptr<void> held;
+    };
+
+    using Granted = std::function<void(WriteLock)>;
+
+    // Calls granted with the WriteLock of key: right away on this thread if no other write of key
+    // holds it, otherwise on the thread that releases it once the writes before have finished.
+    void lock(const std::string& key, Granted granted)
+    {
+        size_t stripe = hash(key) % KEY_LOCKS;
+        {
+            std::lock_guard<std::mutex> lock(locks_m);
+            Stripe& s = stripes[stripe];
+            if (s.held || rebuild_section)
+            {
+                s.waiters.push_back(std::move(granted));
+                return;
+            }
+            s.held = true;
+            writers++;
+        }
+        grant(std::move(granted), stripe);
+    }
+
+    // Adds key, which is about to be stored. Only with the WriteLock of key held.
+    void add(const std::string& key)
+    {
+        uint64_t h = hash(key);
+        std::shared_ptr<Bits> bits = std::atomic_load(&current);
+        if (bits)
+        {
+            bits->add(h);
+            if (bits->estimated_fp_rate() > 2 * fp_rate)
+                request_rebuild();
+        }
+        if (next) // only changed while no WriteLock is held.
+            next->add(h);
+    }
+
+    // A key was deleted from storage.
+    void erased()
+    {
+        std::shared_ptr<Bits> bits = std::atomic_load(&current);
+        if (bits && ++bits->erased > std::max(rebuild_fraction * bits->keys, (double)MIN_DELETES_BEFORE_REBUILD))
+            request_rebuild();
+    }
+
+    Stats stats()
+    {
+        Stats s;
+        s.checks = checks;
+        s.definite_misses = definite_misses;
+        s.false_positives = false_positives;
+        s.rebuilds = rebuilds;
+        if (std::shared_ptr<Bits> bits = std::atomic_load(&current))
+        {
+            s.bits = bits->m;
+            s.hashes = bits->k;
+            s.keys = bits->keys;
+            s.estimated_fp_rate = bits->estimated_fp_rate();
+        }
+        return s;
+    }
+
+private:
+    static const size_t KEY_LOCKS = 256;
+
+    // Writes of the keys that hash to the stripe run one at a time.
+    struct Stripe
+    {
+        bool held = false;
+        std::deque<Granted> waiters;
+    };
+
+    void release(size_t stripe)
+    {
+        Granted next_writer;
+        {
+            std::lock_guard<std::mutex> lock(locks_m);
+            Stripe& s = stripes[stripe];
+            writers--;
+            if (!rebuild_section && !s.waiters.empty())
+            {
+                next_writer = std::move(s.waiters.front());
+                s.waiters.pop_front();
+                writers++;
+            }
+            else
+                s.held = false;
+            if (writers == 0)
+                no_writers.notify_all();
+        }
+        if (next_writer)
+            grant(std::move(next_writer), stripe);
+    }
+
+    // Calls granted with the lock of the stripe, which it holds now. A writer that releases a lock
+    // from inside granted does not call the next writer itself, but leaves it to the outermost
+    // grant on its thread, so that waiting writers that finish at once are not nested ever deeper.
+    void grant(Granted granted, size_t stripe)
+    {
+        thread_local std::deque<std::pair<Granted, WriteLock>>* granting = nullptr;
+        WriteLock lock(std::shared_ptr<void>(nullptr, [this, stripe](void*) { release(stripe); }));
+        if (granting)
+        {
+            granting->emplace_back(std::move(granted), std::move(lock));
+            return;
+        }
+        std::deque<std::pair<Granted, WriteLock>> queue;
+        queue.emplace_back(std::move(granted), std::move(lock));
+        granting = &queue;
+        while (!queue.empty())
+        {
+            std::pair<Granted, WriteLock> next_writer = std::move(queue.front());
+            queue.pop_front();
+            next_writer.first(std::move(next_writer.second));
+        }
+        granting = nullptr;
+    }
+
+    // Runs f while no write holds a lock: waits for the writes in progress, and holds back new ones
+    // until f has returned. For the start and the end of a rebuild.
+    template <typename F>
+    void without_writers(F f)
+    {
+        std::vector<std::pair<Granted, size_t>> waiting;
+        {
+            std::unique_lock<std::mutex> lock(locks_m);
+            rebuild_section = true;
+            no_writers.wait(lock, [&] { return writers == 0; });
+            f();
+            rebuild_section = false;
+            for (size_t i = 0; i < KEY_LOCKS; i++)
+                if (!stripes[i].waiters.empty())
+                {
+                    waiting.emplace_back(std::move(stripes[i].waiters.front()), i);
+                    stripes[i].waiters.pop_front();
+                    stripes[i].held = true;
+                    writers++;
+                }
+        }
+        for (auto& w : waiting)
+            grant(std::move(w.first), w.second);
+    }
+
+    static const size_t MIN_DELETES_BEFORE_REBUILD = 1000; // so that a small store is not scanned after every few deletes.
+
+    struct Bits
+    {
+        Bits(size_t n, double p)
+        {
+            m = std::max((size_t)64, (size_t)std::ceil(-(double)n * std::log(p) / (std::log(2) * std::log(2))));
+            k = std::max(1, (int)std::round((double)m / n * std::log(2)));
+            words.reset(new std::atomic<uint64_t>[(m + 63) / 64]()); // all zero.
+        }
+
+        // Double hashing: bit i is h1 + i * h2.
+        template <typename F>
+        bool each_bit(uint64_t h, F f)
+        {
+            uint64_t h1 = h, h2 = (h >> 33 | h << 31) | 1;
+            for (size_t i = 0; i < k; i++)
+                if (!f((h1 + i * h2) % m))
+                    return false;
+            return true;
+        }
+
+        void add(uint64_t h)
+        {
+            each_bit(h, [&](uint64_t bit) {
+                uint64_t mask = (uint64_t)1 << (bit % 64);
+                if (!(words[bit / 64].fetch_or(mask, std::memory_order_relaxed) & mask))
+                    set++;
+                return true;
+            });
+        }
+
+        bool test(uint64_t h)
+        {
+            return each_bit(h, [&](uint64_t bit) {
+                return (words[bit / 64].load(std::memory_order_relaxed) >> (bit % 64) & 1) != 0;
+            });
+        }
+
+        double estimated_fp_rate() const { return std::pow((double)set / m, (double)k); }
+
+        // Keys added so far (deleted ones included), estimated from the bits set.
+        size_t estimated_keys() const
+        {
+            double fill = std::min((double)set / m, 1 - 1.0 / m);
+            return (size_t)(-(double)m / k * std::log(1 - fill));
+        }
+
+        size_t m, k;
+        std::unique_ptr<std::atomic<uint64_t>[]> words;
+        std::atomic<size_t> set{0}; // bits set.
+        size_t keys = 0; // found by the scan that built it.
+        std::atomic<size_t> erased{0}; // deletes since it was built.
+    };
+
+    static uint64_t hash(const std::string& key)
+    {
+        // FNV-1a, then a final mix so that both halves are usable for double hashing.
+        uint64_t h = 14695981039346656037ULL;
+        for (unsigned char c : key)
+            h = (h ^ c) * 1099511628211ULL;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    // Scans storage into a new filter, sized for twice the keys in the old one (or expected_keys).
+    // Returns null if the scan failed. A rebuild (old not null) makes a filter that succeeds current.
+    std::shared_ptr<Bits> build(const std::shared_ptr<Bits>& old)
+    {
+        size_t n = std::max({expected_keys, old ? 2 * std::max(old->keys, old->estimated_keys()) : 0, (size_t)1});
+        auto bits = std::make_shared<Bits>(n, fp_rate);
+        if (old)
+        {
+            // From now on writes add their key to the new filter too. Waits for the writes in
+            // progress, which may have added theirs only to the old one.
+            without_writers([&] { next = bits; });
+        }
+        size_t keys = 0;
+        bool ok = scan([&](const std::string& key) {
+            bits->add(hash(key));
+            keys++;
+        });
+        bits->keys = keys;
+        if (old)
+        {
+            // In the same section as next is cleared: a write in between would add its key only to
+            // the old filter, and be lost once the new one replaced it.
+            without_writers([&] {
+                next = nullptr;
+                if (ok)
+                    std::atomic_store(&current, bits);
+            });
+        }
+        return ok ? bits : nullptr;
+    }
+
+    void request_rebuild()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            rebuild_requested = true;
+        }
+        cv.notify_one();
+    }
+
+    void run_rebuilder()
+    {
+        std::unique_lock<std::mutex> lock(m);
+        while (true)
+        {
+            cv.wait(lock, [&] { return stopping || rebuild_requested; });
+            if (stopping)
+                return;
+            lock.unlock();
+            std::shared_ptr<Bits> old = std::atomic_load(&current);
+            std::shared_ptr<Bits> bits = build(old ? old : std::make_shared<Bits>(expected_keys, fp_rate));
+            if (bits)
+                rebuilds++;
+            lock.lock();
+            // Requests made during the scan are satisfied by it, unless so many keys were added
+            // meanwhile that the new filter is already too full.
+            rebuild_requested = bits && bits->estimated_fp_rate() > 2 * fp_rate;
+        }
+    }
+
+    size_t expected_keys;
+    double fp_rate, rebuild_fraction;
+    Scan scan;
+
+    std::shared_ptr<Bits> current; // null if the filter could not be built. Accessed atomically.
+    std::shared_ptr<Bits> next; // being built. Only changed while no WriteLock is held.
+
+    std::mutex locks_m; // guards the write locks below.
+    Stripe stripes[KEY_LOCKS];
+    size_t writers = 0; // WriteLocks held.
+    bool rebuild_section = false; // no WriteLocks are granted.
+    std::condition_variable no_writers;
+
+    std::atomic<size_t> checks{0}, definite_misses{0}, false_positives{0}, rebuilds{0};
+
+    std::mutex m; // guards the rebuilder's state below.
+    std::condition_variable cv;
+    bool rebuild_requested = false, stopping = false;
+    std::thread rebuilder;
+};
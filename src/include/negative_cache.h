@@ -0,0 +1,113 @@
+// Remembers keys that the database recently reported as nonexistent, so /read and /rotate2 can
+// answer "Key does not exist." without a database round trip.
+//
+// Entries expire after a short TTL and the number of entries is bounded. All entries have the
+// same TTL, so the oldest entry is always the first to expire, and a FIFO queue is enough for
+// both expiry and eviction.
+//
+// A lookup and the later insert are separated by a database call, during which another request
+// may create the key. insert() therefore takes the epoch read before the database call, and every
+// erase() moves the epoch forward, so a result that raced with a /create is never remembered.
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class NegativeCache
+{
+public:
+    struct Stats
+    {
+        size_t hits = 0, misses = 0, entries = 0;
+    };
+
+    NegativeCache(size_t capacity, std::chrono::milliseconds ttl) : capacity(capacity), ttl(ttl) {}
+
+    // Returns true if key is known not to exist in the database.
+    bool contains(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        auto it = pos.find(key);
+        if (it != pos.end() && it->second->expiry > Clock::now())
+        {
+            counters.hits++;
+            return true;
+        }
+        if (it != pos.end()) // expired.
+        {
+            order.erase(it->second);
+            pos.erase(it);
+        }
+        counters.misses++;
+        return false;
+    }
+
+    // To be read before asking the database whether key exists, and passed to insert.
+    uint64_t epoch()
+    {
+        std::lock_guard<std::mutex> lock(m);
+        return current_epoch;
+    }
+
+    // Remembers that key does not exist, unless some key was created since seen_epoch.
+    void insert(const std::string& key, uint64_t seen_epoch)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        if (capacity == 0 || seen_epoch != current_epoch)
+            return;
+        auto it = pos.find(key);
+        if (it != pos.end())
+        {
+            order.erase(it->second);
+            pos.erase(it);
+        }
+        while (order.size() >= capacity)
+        {
+            pos.erase(order.front().key);
+            order.pop_front();
+        }
+        order.push_back({key, Clock::now() + ttl});
+        pos[key] = std::prev(order.end());
+    }
+
+    // Called when key is (or may be) created.
+    void erase(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        current_epoch++;
+        auto it = pos.find(key);
+        if (it == pos.end())
+            return;
+        order.erase(it->second);
+        pos.erase(it);
+    }
+
+    Stats stats()
+    {
+        std::lock_guard<std::mutex> lock(m);
+        Stats s = counters;
+        s.entries = order.size();
+        return s;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+    struct Entry
+    {
+        std::string key;
+        Clock::time_point expiry;
+    };
+
+    std::mutex m;
+    std::list<Entry> order; // oldest (first to expire) at the front.
+    std::unordered_map<std::string, std::list<Entry>::iterator> pos;
+    size_t capacity;
+    std::chrono::milliseconds ttl;
+    uint64_t current_epoch = 0;
+    Stats counters;
+};
@@ -0,0 +1,50 @@
+// Startup options for the server and database processes.
+// Options are given on the command line as --name=value, e.g. ./server --cache-bytes=67108864
+// Every option has a default (the #defines at the top of each program), so running without
+// options behaves as before.
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+class Options
+{
+public:
+    Options(int argc, char* argv[])
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            size_t eq = arg.find('=');
+            if (arg.rfind("--", 0) != 0 || eq == std::string::npos)
+            {
+                std::cerr << "Ignoring option " << arg << ", expected --name=value\n";
+                continue;
+            }
+            values[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+        }
+    }
+
+    std::string get(const std::string& name, const std::string& default_value) const
+    {
+        auto it = values.find(name);
+        return it == values.end() ? default_value : it->second;
+    }
+
+    size_t get(const std::string& name, size_t default_value) const
+    {
+        auto it = values.find(name);
+        return it == values.end() ? default_value : std::stoull(it->second);
+    }
+
+    double get(const std::string& name, double default_value) const
+    {
+        auto it = values.find(name);
+        return it == values.end() ? default_value : std::stod(it->second);
+    }
+
+private:
+    std::unordered_map<std::string, std::string> values;
+};
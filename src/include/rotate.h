@@ -0,0 +1,127 @@
+// Rotation step of /rotate and /rotate2: rotates a decoded image counter-clockwise by a whole
+// number of degrees, into a canvas large enough for all of it.
+//
+// Multiples of 90 degrees (and 0 / 360) are exact pixel moves, so they skip warpAffine and its
+// bilinear interpolation: 0 returns the image itself, 90 / 180 / 270 copy every pixel once to its
+// new place. For 90 and 270 a row of the source becomes a column of the result, so the copy walks
+// the image in TILE x TILE blocks: the source rows and result rows of one block stay in the L1
+// cache instead of every write of a column touching a new cache line.
+//
+// Other angles go through warpAffine. Every row of its result is computed from the source on its
+// own, so with a ParallelFor the result can be split into horizontal tiles (bands of rows) that
+// are warped at the same time, each with the matrix shifted to its first row.
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+
+namespace rotation
+{
+const int TILE = 32; // pixels. 32 rows of 32 RGB pixels (3 KB) read and written per block.
+
+template <size_t N>
+struct Pixel
+{
+    uint8_t c[N];
+};
+
+// dst must be allocated with the rotated size.
+template <size_t N>
+void rotate_right_angle(const cv::Mat& src, cv::Mat& dst, int quarter_turns)
+{
+    typedef Pixel<N> P;
+    const int rows = src.rows, cols = src.cols;
+    if (quarter_turns == 2)
+    {
+        for (int r = 0; r < rows; r++)
+        {
+            const P* s = src.ptr<P>(r);
+            P* d = dst.ptr<P>(rows - 1 - r) + cols - 1;
+            for (int c = 0; c < cols; c++)
+                *(d - c) = s[c];
+        }
+        return;
+    }
+
+    for (int r0 = 0; r0 < rows; r0 += TILE)
+        for (int c0 = 0; c0 < cols; c0 += TILE)
+        {
+            int r1 = std::min(r0 + TILE, rows), c1 = std::min(c0 + TILE, cols);
+            for (int c = c0; c < c1; c++)
+            {
+                // Source column c becomes result row cols-1-c (90) or c (270), written left to right.
+                P* d = quarter_turns == 1 ? dst.ptr<P>(cols - 1 - c) : dst.ptr<P>(c);
+                for (int r = r0; r < r1; r++)
+                    d[quarter_turns == 1 ? r : rows - 1 - r] = src.ptr<P>(r)[c];
+            }
+        }
+}
+}
+
+// Runs part(0) .. part(parts - 1), possibly at the same time, and returns when all are done.
+typedef std::function<void(size_t parts, const std::function<void(size_t)>& part)> ParallelFor;
+
+// Rotates img counter-clockwise by angle degrees. The result may share its pixels with img. If
+// tiles > 1, a warpAffine is split into that many row tiles, run with parallel_for.
+inline cv::Mat rotate_image(const cv::Mat& img, int angle, const ParallelFor& parallel_for = nullptr, size_t tiles = 1)
+{
+    int normalized = (angle % 360 + 360) % 360;
+    if (normalized % 90 == 0)
+    {
+        int quarter_turns = normalized / 90;
+        if (quarter_turns == 0)
+            return img;
+        cv::Mat rotated(quarter_turns == 2 ? img.rows : img.cols, quarter_turns == 2 ? img.cols : img.rows, img.type());
+        switch (img.elemSize())
+        {
+        case 1:
+            rotation::rotate_right_angle<1>(img, rotated, quarter_turns);
+            return rotated;
+        case 3:
+            rotation::rotate_right_angle<3>(img, rotated, quarter_turns);
+            return rotated;
+        case 4:
+            rotation::rotate_right_angle<4>(img, rotated, quarter_turns);
+            return rotated;
+        default:
+            cv::rotate(img, rotated, quarter_turns == 1 ? cv::ROTATE_90_COUNTERCLOCKWISE
+                                     : quarter_turns == 2 ? cv::ROTATE_180 : cv::ROTATE_90_CLOCKWISE);
+            return rotated;
+        }
+    }
+
+    // Get the rotation matrix
+    cv::Point2f center(img.cols / 2.0F, img.rows / 2.0F);
+    cv::Mat rotation_matrix = cv::getRotationMatrix2D(center, angle, 1);
+
+    // Compute bounding box so that the rotated image fits completely
+    cv::Rect2f bbox = cv::RotatedRect(cv::Point2f(), img.size(), angle).boundingRect2f();
+
+    // Adjust transformation matrix to keep image centered
+    rotation_matrix.at<double>(0, 2) += bbox.width / 2.0 - img.cols / 2.0;
+    rotation_matrix.at<double>(1, 2) += bbox.height / 2.0 - img.rows / 2.0;
+
+    // Apply the rotation
+    cv::Mat rotated;
+    if (!parallel_for || tiles <= 1)
+    {
+        cv::warpAffine(img, rotated, rotation_matrix, bbox.size());
+        return rotated;
+    }
+    rotated.create(bbox.size(), img.type());
+    int rows_per_tile = (rotated.rows + (int)tiles - 1) / (int)tiles;
+    parallel_for(tiles, [&](size_t t) {
+        int first = std::min((int)t * rows_per_tile, rotated.rows), last = std::min(first + rows_per_tile, rotated.rows);
+        if (first == last)
+            return;
+        // Row first of the result is row 0 of the tile, which warpAffine writes in place since it
+        // already has the right size and type.
+        cv::Mat tile = rotated.rowRange(first, last), tile_matrix = rotation_matrix.clone();
+        tile_matrix.at<double>(1, 2) -= first;
+        cv::warpAffine(img, tile, tile_matrix, tile.size());
+    });
+    return rotated;
+}
@@ -0,0 +1,75 @@
+// Coalesces concurrent calls for the same key into one.
+// The first caller for a key runs the function (e.g. a database read). Callers for the same key
+// that arrive while it is running do not run it again; they wait for the first call and share its
+// result. Used by the server so a burst of reads of one uncached image costs one database fetch.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+template <typename T>
+class SingleFlight
+{
+public:
+    T run(const std::string& key, const std::function<T()>& fn)
+    {
+        std::promise<T> promise;
+        std::shared_future<T> result;
+        bool leader = false;
+        {
+            std::lock_guard<std::mutex> lock(m);
+            auto it = calls.find(key);
+            if (it != calls.end())
+            {
+                result = it->second;
+                coalesced_calls++;
+            }
+            else
+            {
+                result = promise.get_future().share();
+                calls.emplace(key, result);
+                executed_calls++;
+                leader = true;
+            }
+        }
+        if (!leader)
+            return result.get(); // someone else is fetching key, wait for it.
+
+        try
+        {
+            T value = fn();
+            forget(key);
+            promise.set_value(value);
+            return value;
+        }
+        catch (...)
+        {
+            forget(key);
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+    }
+
+    // Number of calls that ran the function.
+    size_t executed() const { return executed_calls; }
+    // Number of calls that shared the result of a call already in flight.
+    size_t coalesced() const { return coalesced_calls; }
+
+private:
+    void forget(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        calls.erase(key);
+    }
+
+    std::mutex m;
+    std::unordered_map<std::string, std::shared_future<T>> calls; // calls in flight.
+    std::atomic<size_t> executed_calls{0};
+    std::atomic<size_t> coalesced_calls{0};
+};
@@ -0,0 +1,70 @@
+// Interface between the database's HTTP handlers and the store that keeps the images.
+// The database runs one engine, chosen at startup with --engine: Cassandra (cassandra_engine.h)
+// or the embedded log-structured engine (bitcask_engine.h).
+//
+// All methods are called concurrently, from httplib's worker threads or the database's event loop.
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// A piece of a stored value. data stays valid as long as owner (e.g. a driver result or a read
+// buffer) is alive, so it can be sent without copying.
+struct Blob
+{
+    const char* data;
+    size_t size;
+    std::shared_ptr<const void> owner;
+};
+
+class StorageEngine
+{
+public:
+    enum Status { OK, NOT_FOUND, EXISTS, FAILED };
+
+    virtual ~StorageEngine() = default;
+
+    // Stores value under key, replacing any old value.
+    virtual Status put(const std::string& key, const std::string& value) = 0;
+    // Stores value under key only if key does not exist. Returns OK or EXISTS.
+    virtual Status put_if_absent(const std::string& key, const std::string& value) = 0;
+    // On OK, value holds the pieces of the value of key, in order (more than one if the engine
+    // splits large values).
+    virtual Status get(const std::string& key, std::vector<Blob>& value) = 0;
+    // Removes key. Returns OK whether or not it existed.
+    virtual Status erase(const std::string& key) = 0;
+
+    // The same operations, for a caller that does not wait: done is called exactly once with the
+    // result, on whichever thread has it (e.g. a driver callback), possibly before the call returns.
+    // key and value are only read during the call. An engine that cannot answer asynchronously
+    // runs the operation right away and calls done before returning.
+    using Done = std::function<void(Status)>;
+    using GetDone = std::function<void(Status, std::vector<Blob>)>;
+    virtual void put_async(const std::string& key, const std::string& value, Done done) { done(put(key, value)); }
+    virtual void put_if_absent_async(const std::string& key, const std::string& value, Done done)
+    {
+        done(put_if_absent(key, value));
+    }
+    virtual void get_async(const std::string& key, GetDone done)
+    {
+        std::vector<Blob> value;
+        Status status = get(key, value);
+        done(status, std::move(value));
+    }
+    virtual void erase_async(const std::string& key, Done done) { done(erase(key)); }
+
+    // Whether the asynchronous operations return before the store has answered, so that a few
+    // threads can keep many operations in flight.
+    virtual bool asynchronous() const { return false; }
+
+    // Calls fn with every stored key, e.g. to build the database's key filter. Keys written or
+    // deleted meanwhile may or may not be included. Returns false if the keys could not be listed.
+    virtual bool for_each_key(const std::function<void(const std::string&)>& /*fn*/) { return false; }
+
+    // Engine specific counters, for /printStatistics. May reset peak values.
+    virtual void print_stats(std::ostream& /*out*/) {}
+};
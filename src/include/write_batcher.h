@@ -0,0 +1,191 @@
+// Groups inserts that arrive at the database at about the same time into one unlogged CassBatch,
+// so that a burst of writes costs one request to Cassandra instead of one per image.
+//
+// A writer binds its own statement (so the image is copied into it on the writer's thread), hands
+// it to write() and waits, or to write_async() with a callback. A flusher thread collects the
+// statements that arrive within the window after the first one, or until max_statements /
+// max_bytes is reached, sends them as one batch and, when the driver's callback reports the
+// result, wakes every waiting writer of the batch and calls the callbacks of the others. While a batch is
+// in Cassandra the flusher already collects the next one.
+//
+// Every key is its own partition (image_id is the partition key), and every statement carries its
+// own write timestamp (USING TIMESTAMP), so Cassandra orders writes of a key by that, not by their
+// place in a batch. The database writes a key once at a time anyway, so every statement is sent.
+//
+// Cassandra rejects batches above batch_size_fail_threshold_in_kb (50 KB by default, which is
+// less than most images), so max_bytes must stay below that setting of cassandra.yaml. A statement
+// larger than max_bytes, or any statement when the window is 0, is not accepted and is to be
+// executed on its own by the caller.
+#pragma once
+
+#include <cassandra.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WriteBatcher
+{
+public:
+    using Done = std::function<void(CassError)>;
+
+    struct Stats
+    {
+        size_t batches = 0, batched_writes = 0; // batches sent and the writes they carried.
+        size_t max_batch = 0;
+    };
+
+    WriteBatcher(CassSession* session, std::chrono::microseconds window, size_t max_statements, size_t max_bytes)
+        : session(session), window(window), max_statements(std::max(max_statements, (size_t)1)),
+          max_bytes(max_bytes)
+    {
+        if (window.count() > 0)
+            flusher = std::thread([this] { run(); });
+    }
+
+    WriteBatcher(const WriteBatcher&) = delete;
+    WriteBatcher& operator=(const WriteBatcher&) = delete;
+
+    // Sends what is queued, then stops the flusher.
+    ~WriteBatcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        if (flusher.joinable())
+            flusher.join();
+    }
+
+    // Whether a write of bytes bytes goes through a batch. Others are to be executed on their own.
+    bool accepts(size_t bytes) const { return window.count() > 0 && bytes <= max_bytes; }
+
+    // Executes stmt, an insert of bytes bytes, as part of a batch and returns its error code once
+    // the batch is done. Takes ownership of stmt. Only for writes it accepts().
+    CassError write(CassStatement* stmt, size_t bytes)
+    {
+        auto done = std::make_shared<std::promise<CassError>>();
+        write_async(stmt, bytes, [done](CassError rc) { done->set_value(rc); });
+        return done->get_future().get();
+    }
+
+    // The same without waiting: done is called with the error code on a driver thread once the
+    // batch is done.
+    void write_async(CassStatement* stmt, size_t bytes, Done done)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            queue.push_back({stmt, bytes, std::move(done), Clock::now()});
+            queued_bytes += bytes;
+        }
+        cv.notify_one();
+    }
+
+    Stats stats()
+    {
+        std::lock_guard<std::mutex> lock(m);
+        return counters;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Pending
+    {
+        CassStatement* stmt;
+        size_t bytes;
+        Done done;
+        Clock::time_point arrival;
+    };
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(m);
+        while (true)
+        {
+            cv.wait(lock, [&] { return stopping || !queue.empty(); });
+            if (queue.empty()) // stopping, and everything was sent.
+                return;
+            cv.wait_until(lock, queue.front().arrival + window, [&] {
+                return stopping || queue.size() >= max_statements || queued_bytes >= max_bytes;
+            });
+
+            // Take the oldest writes, up to the limits (at least one).
+            std::vector<Pending> batch;
+            size_t bytes = 0;
+            while (!queue.empty() && batch.size() < max_statements &&
+                   (batch.empty() || bytes + queue.front().bytes <= max_bytes))
+            {
+                bytes += queue.front().bytes;
+                batch.push_back(std::move(queue.front()));
+                queue.pop_front();
+            }
+            queued_bytes -= bytes;
+
+            lock.unlock();
+            send(batch);
+            lock.lock();
+        }
+    }
+
+    // Everything needed by the driver's callback to wake the writers of one batch.
+    struct InFlight
+    {
+        std::vector<Done> waiters;
+    };
+
+    static void on_batch_done(CassFuture* future, void* data)
+    {
+        InFlight* in_flight = static_cast<InFlight*>(data);
+        CassError rc = cass_future_error_code(future);
+        for (auto& done : in_flight->waiters)
+            done(rc);
+        delete in_flight;
+    }
+
+    // Called by the flusher without the lock.
+    void send(std::vector<Pending>& batch)
+    {
+        CassBatch* cass_batch = cass_batch_new(CASS_BATCH_TYPE_UNLOGGED);
+        InFlight* in_flight = new InFlight();
+        for (auto& pending : batch)
+        {
+            cass_batch_add_statement(cass_batch, pending.stmt);
+            cass_statement_free(pending.stmt); // the batch keeps its own reference.
+            in_flight->waiters.push_back(std::move(pending.done));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m);
+            counters.batches++;
+            counters.batched_writes += batch.size();
+            counters.max_batch = std::max(counters.max_batch, batch.size());
+        }
+
+        CassFuture* future = cass_session_execute_batch(session, cass_batch);
+        cass_future_set_callback(future, on_batch_done, in_flight);
+        cass_future_free(future); // the callback still runs.
+        cass_batch_free(cass_batch);
+    }
+
+    CassSession* session;
+    std::chrono::microseconds window;
+    size_t max_statements, max_bytes;
+
+    std::mutex m; // guards everything below.
+    std::condition_variable cv;
+    std::deque<Pending> queue; // oldest first.
+    size_t queued_bytes = 0;
+    bool stopping = false;
+    Stats counters;
+    std::thread flusher;
+};
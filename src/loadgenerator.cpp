@@ -1,6 +1,15 @@
 // example usage:
 // ./ldgen 2 5
 // this starts 2 clients which do load test for 5 minutes.
+// ./ldgen 2 5 zipf,read
+// runs only the given load tests (phases), in that order. Default is create,read,rotate.
+// ./ldgen 64 1 dbstress
+// sends mixed create/read/delete requests straight to the database from 64 threads and checks every answer.
+// ./ldgen 4 5 sizes
+// writes and reads back blobs from 64 KB to 16 MB straight at the database and prints the times per size.
+// ./ldgen 16 1 rotateflood
+// half the threads read cached keys for the whole minute, the other half flood the server with /rotate
+// from half time on. Prints the read latency percentiles before and during the flood.
 
 #include "include/httplib.h"
 #include <fstream>
@@ -10,6 +19,10 @@
 #include <thread>
 #include <string>
 #include <random>
+#include <cmath>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
 
 namespace fs = std::filesystem;
 using namespace std::chrono;
@@ -17,6 +30,9 @@ using namespace std::chrono;
 #define SERVER_ADDRESS "http://127.0.0.1:5000"
 #define DATABASE_ADDRESS "http://127.0.0.1:5001"
 #define CPU_core_id 2 // used to pin the process to core.
+#define ZIPF_KEYS 1000 // number of distinct keys read by the zipf load test.
+#define ZIPF_S 0.99 // skew of the zipf load test. Key of rank k is read with probability ~ 1/k^ZIPF_S.
+#define FLOOD_KEYS 100 // number of distinct keys read by the rotateflood load test.
 int numthreads;
 int duration_seconds; // each thread will run for this duration.
 // Read all the images at once, since reading images from disk would take considerable time during load test, slowing 
@@ -71,6 +87,41 @@ void create_all(int id)
     }while (elapsed.count() < duration_seconds);
 }
 
+// Like create_all, but sends plain inserts (upserts) straight to the database's /create, the
+// requests that the database batches (see --write-batch-window-us of the database).
+void db_create_all(int id)
+{
+    httplib::Client db(DATABASE_ADDRESS);
+    int i = 0;
+    std::string _id_ = "dbcreate" + std::to_string(id) + "_";
+    std::chrono::duration<double> elapsed;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    do
+    {
+        std::string key = _id_ + std::to_string(i % 1000); // overwrites its own keys after a while.
+        httplib::UploadFormDataItems items = {
+            {"file", images[i % numimages], key, "image/jpeg"}
+        };
+        i += 1;
+
+        auto curr = std::chrono::high_resolution_clock::now();
+        auto res = db.Post("/create", items);
+        auto end = std::chrono::high_resolution_clock::now();
+
+        if (res && res->status == 200)
+            avg_throughput[id] += 1;
+        else
+            std::cout << "Create request failed\n";
+
+        elapsed = end - start;
+        auto resp_time = std::chrono::duration_cast<std::chrono::milliseconds>(end - curr);
+        avg_response_time[id] += resp_time.count();
+        num_requests[id]++;
+
+    }while (elapsed.count() < duration_seconds);
+}
+
 void read_all(int id)
 {
     httplib::Client cli(SERVER_ADDRESS); // IP:Port of server.
@@ -211,6 +262,314 @@ void delete_all(int id)
 }
 
 
+// Reads keys "zipf0" .. "zipf<ZIPF_KEYS-1>" (created by zipf_populate) with a zipf distribution, so a
+// few keys are very hot and most keys are rarely read. Used to compare the hit ratio of cache policies.
+std::vector<double> zipf_cdf;
+
+void zipf_populate()
+{
+    httplib::Client cli(SERVER_ADDRESS);
+    double sum = 0;
+    zipf_cdf.clear();
+    for (int k = 0; k < ZIPF_KEYS; k++)
+    {
+        sum += 1.0 / std::pow(k + 1, ZIPF_S);
+        zipf_cdf.push_back(sum);
+
+        // If the key is already present from an earlier run, the server just says so.
+        httplib::UploadFormDataItems items = {
+            {"file", images[k % numimages], "zipf" + std::to_string(k), "image/jpeg"}
+        };
+        cli.Post("/create", items);
+    }
+    for (auto& c : zipf_cdf)
+        c /= sum;
+}
+
+void zipf_read(int id)
+{
+    httplib::Client cli(SERVER_ADDRESS); // IP:Port of server.
+    std::chrono::duration<double> elapsed;
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_real_distribution<> dist(0.0, 1.0);
+    auto start = std::chrono::high_resolution_clock::now();
+
+    do
+    {
+        int k = std::lower_bound(zipf_cdf.begin(), zipf_cdf.end(), dist(gen)) - zipf_cdf.begin();
+        std::string key = "zipf" + std::to_string(std::min(k, ZIPF_KEYS - 1));
+
+        auto curr = std::chrono::high_resolution_clock::now();
+        auto res = cli.Get("/read?key=" + key);
+        auto end = std::chrono::high_resolution_clock::now();
+        if (res)
+        {
+            avg_throughput[id] += 1;
+        }
+        else
+        {
+            std::cout << "Read request failed\n";
+        }
+        elapsed = end - start;
+        auto resp_time = std::chrono::duration_cast<std::chrono::milliseconds>(end - curr);
+        avg_response_time[id] += resp_time.count();
+        num_requests[id]++;
+
+    }while (elapsed.count() < duration_seconds);
+}
+
+// Stress test of the database process alone (no server, no cache). Every thread runs
+// create_if_absent, read, overwrite, read, delete, read on keys of its own, so the expected answer
+// of every request is known, and counts the answers that differ. Any cross-talk between concurrent
+// requests inside the database (wrong image, wrong status) shows up as a failure.
+// Every thread also keeps one key for the whole run and reads it back after every round: the
+// deletes make the database rebuild its key filter again and again, and a rebuild that lost a key
+// written meanwhile would answer that it does not exist.
+std::atomic<int> db_stress_failures{0};
+
+void db_stress(int id)
+{
+    httplib::Client db(DATABASE_ADDRESS);
+    std::string prefix = "dbstress_" + std::to_string(getpid()) + "_" + std::to_string(id) + "_";
+    int i = 0;
+    std::chrono::duration<double> elapsed;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Sends one request and checks its answer. expected_body is ignored if null.
+    auto check = [&](const httplib::Result& res, const std::string* expected_body, const char* what,
+                     const std::string& key, std::chrono::high_resolution_clock::time_point curr) {
+        auto end = std::chrono::high_resolution_clock::now();
+        if (!res || res->status != 200 || (expected_body && res->body != *expected_body))
+        {
+            db_stress_failures++;
+            std::cout << "Unexpected answer to " << what << " [" << key << "]\n";
+        }
+        else
+            avg_throughput[id] += 1;
+        avg_response_time[id] += std::chrono::duration_cast<std::chrono::milliseconds>(end - curr).count();
+        num_requests[id]++;
+        elapsed = end - start;
+    };
+
+    const std::string created = "Created", present = "Key already present", missing = "Key does not exist.";
+    const std::string kept = prefix + "kept";
+    const std::string& kept_image = images[id % numimages];
+    auto curr = std::chrono::high_resolution_clock::now();
+    check(db.Post("/create", httplib::UploadFormDataItems{{"file", kept_image, kept, "image/jpeg"}}),
+          nullptr, "create", kept, curr);
+    do
+    {
+        std::string key = prefix + std::to_string(i);
+        const std::string& first = images[i % numimages];
+        const std::string& second = images[(i + 1) % numimages];
+        i++;
+        httplib::Params params;
+        params.emplace("key", key);
+
+        curr = std::chrono::high_resolution_clock::now();
+        check(db.Post("/create_if_absent", httplib::UploadFormDataItems{{"file", first, key, "image/jpeg"}}),
+              &created, "create_if_absent", key, curr);
+        curr = std::chrono::high_resolution_clock::now();
+        check(db.Get("/read?key=" + key), &first, "read", key, curr);
+        curr = std::chrono::high_resolution_clock::now();
+        check(db.Post("/create_if_absent", httplib::UploadFormDataItems{{"file", second, key, "image/jpeg"}}),
+              &present, "create_if_absent of an existing key", key, curr);
+        curr = std::chrono::high_resolution_clock::now();
+        check(db.Post("/create", httplib::UploadFormDataItems{{"file", second, key, "image/jpeg"}}),
+              nullptr, "create", key, curr);
+        curr = std::chrono::high_resolution_clock::now();
+        check(db.Get("/read?key=" + key), &second, "read after overwrite", key, curr);
+        curr = std::chrono::high_resolution_clock::now();
+        check(db.Post("/delete", params), nullptr, "delete", key, curr);
+        curr = std::chrono::high_resolution_clock::now();
+        check(db.Get("/read?key=" + key), &missing, "read after delete", key, curr);
+        curr = std::chrono::high_resolution_clock::now();
+        check(db.Get("/read?key=" + kept), &kept_image, "read of the kept key", kept, curr);
+
+    }while (elapsed.count() < duration_seconds);
+    httplib::Params params;
+    params.emplace("key", kept);
+    db.Post("/delete", params);
+}
+
+// Writes and reads back blobs of several sizes straight at the database, to compare the inline
+// and the chunked layout (--chunk-bytes of the database) across image sizes. Every thread cycles
+// through the sizes on keys of its own; the time of every create and read is kept per size.
+const std::vector<size_t> blob_sizes = {64 << 10, 256 << 10, 1 << 20, 4 << 20, 16 << 20};
+std::vector<std::string> blobs; // one random (incompressible) blob per size.
+std::atomic<long> size_creates[5], size_reads[5], size_create_ms[5], size_read_ms[5], size_failures[5];
+
+void sizes_populate()
+{
+    std::mt19937 gen(42);
+    blobs.clear();
+    for (size_t size : blob_sizes)
+    {
+        std::string blob(size, '\0');
+        for (auto& c : blob)
+            c = (char)gen();
+        blobs.push_back(blob);
+    }
+    for (size_t s = 0; s < blob_sizes.size(); s++)
+        size_creates[s] = size_reads[s] = size_create_ms[s] = size_read_ms[s] = size_failures[s] = 0;
+}
+
+void sizes_all(int id)
+{
+    httplib::Client db(DATABASE_ADDRESS);
+    int i = 0;
+    std::chrono::duration<double> elapsed;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    do
+    {
+        size_t s = i % blob_sizes.size();
+        i++;
+        std::string key = "size" + std::to_string(id) + "_" + std::to_string(s);
+        httplib::UploadFormDataItems items = {
+            {"file", blobs[s], key, "image/jpeg"}
+        };
+
+        auto curr = std::chrono::high_resolution_clock::now();
+        auto res = db.Post("/create", items);
+        auto mid = std::chrono::high_resolution_clock::now();
+        auto res2 = db.Get("/read?key=" + key);
+        auto end = std::chrono::high_resolution_clock::now();
+
+        if (!res || res->status != 200 || !res2 || res2->status != 200 || res2->body != blobs[s])
+            size_failures[s]++;
+        else
+        {
+            avg_throughput[id] += 2;
+            size_creates[s]++;
+            size_reads[s]++;
+            size_create_ms[s] += std::chrono::duration_cast<std::chrono::milliseconds>(mid - curr).count();
+            size_read_ms[s] += std::chrono::duration_cast<std::chrono::milliseconds>(end - mid).count();
+        }
+        elapsed = end - start;
+        avg_response_time[id] += std::chrono::duration_cast<std::chrono::milliseconds>(end - curr).count() / 2;
+        num_requests[id] += 2;
+
+    }while (elapsed.count() < duration_seconds);
+}
+
+void print_sizes()
+{
+    std::cout << "size (KB)  creates/s  avg create (ms)  avg read (ms)  failures\n";
+    for (size_t s = 0; s < blob_sizes.size(); s++)
+    {
+        double n = std::max(size_creates[s].load(), 1L);
+        std::cout << (blob_sizes[s] >> 10) << "  " << size_creates[s] / (double)duration_seconds << "  "
+                  << size_create_ms[s] / n << "  " << size_read_ms[s] / n << "  " << size_failures[s] << "\n";
+    }
+}
+
+// Read latency under a rotate flood: even threads read keys "flood0" .. "flood<FLOOD_KEYS-1>" (cache
+// hits after flood_populate) for the whole run, odd threads send /rotate requests with random angles
+// from flood_start on. The latency of every read is kept, split into the reads before the flood and
+// the reads during it, so that print_flood can compare their percentiles.
+std::vector<std::vector<double>> flood_read_ms[2]; // per thread: [0] before the flood, [1] during it.
+std::atomic<long> flood_rotations{0}, flood_rejected{0};
+std::chrono::steady_clock::time_point flood_start;
+
+void flood_populate()
+{
+    httplib::Client cli(SERVER_ADDRESS);
+    for (int k = 0; k < FLOOD_KEYS; k++)
+    {
+        std::string key = "flood" + std::to_string(k);
+        httplib::UploadFormDataItems items = {
+            {"file", images[k % numimages], key, "image/jpeg"}
+        };
+        cli.Post("/create", items); // already present from an earlier run is fine too.
+        cli.Get("/read?key=" + key); // into the cache.
+    }
+    for (auto& v : flood_read_ms)
+        v.assign(numthreads, std::vector<double>());
+    flood_rotations = flood_rejected = 0;
+    flood_start = std::chrono::steady_clock::now() + std::chrono::seconds(duration_seconds / 2);
+}
+
+void rotate_flood(int id)
+{
+    httplib::Client cli(SERVER_ADDRESS); // IP:Port of server.
+    std::chrono::duration<double> elapsed;
+    std::mt19937 gen(id);
+    std::uniform_int_distribution<> angles(1, 359);
+    int i = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    if (id % 2 == 1)
+        std::this_thread::sleep_until(flood_start);
+
+    do
+    {
+        std::string key = "flood" + std::to_string(i % FLOOD_KEYS);
+        i++;
+        auto curr = std::chrono::high_resolution_clock::now();
+        httplib::Result res;
+        if (id % 2 == 0)
+            res = cli.Get("/read?key=" + key);
+        else
+            res = cli.Post("/rotate", httplib::UploadFormDataItems{
+                {"file", images[i % numimages], std::to_string(angles(gen)), "image/jpeg"}});
+        auto end = std::chrono::high_resolution_clock::now();
+
+        double ms = std::chrono::duration<double, std::milli>(end - curr).count();
+        if (!res || (res->status != 200 && res->status != 503))
+            std::cout << (id % 2 == 0 ? "Read" : "Rotate") << " request failed\n";
+        else if (id % 2 == 0)
+        {
+            avg_throughput[id] += 1;
+            flood_read_ms[std::chrono::steady_clock::now() >= flood_start][id].push_back(ms);
+        }
+        else if (res->status == 503) // the server's transform queue was full.
+            flood_rejected++;
+        else
+        {
+            avg_throughput[id] += 1;
+            flood_rotations++;
+        }
+        elapsed = end - start;
+        avg_response_time[id] += ms;
+        num_requests[id]++;
+
+    }while (elapsed.count() < duration_seconds);
+}
+
+void print_flood()
+{
+    std::cout << "reads              count  p50 (ms)  p99 (ms)  max (ms)\n";
+    for (int during = 0; during < 2; during++)
+    {
+        std::vector<double> all;
+        for (const auto& v : flood_read_ms[during])
+            all.insert(all.end(), v.begin(), v.end());
+        std::sort(all.begin(), all.end());
+        auto percentile = [&](double p) { return all.empty() ? 0 : all[std::min(all.size() - 1, (size_t)(p * all.size()))]; };
+        std::cout << (during ? "during the flood   " : "before the flood   ") << all.size() << "  " << percentile(0.5)
+                  << "  " << percentile(0.99) << "  " << (all.empty() ? 0 : all.back()) << "\n";
+    }
+    std::cout << "Rotations: " << flood_rotations / (duration_seconds / 2.0) << "/sec, refused as busy: " << flood_rejected << "\n";
+}
+
+// Returns the value of one counter from the server's /metrics page, or -1 if it is not there.
+double get_metric(httplib::Client& cli, const std::string& name)
+{
+    auto res = cli.Get("/metrics");
+    if (!res)
+        return -1;
+    std::istringstream iss(res->body);
+    std::string k;
+    double v;
+    while (iss >> k >> v)
+    {
+        if (k == name)
+            return v;
+    }
+    return -1;
+}
+
 void create_read_delete_mix(int id)
 {
     if (id % 3 == 0)
@@ -269,186 +628,95 @@ int main(int argc, char* argv[])
     avg_response_time.resize(numthreads);
     num_requests.resize(numthreads);
 
-    // create_all(): each client will run this. (IO bound)
-    std::cout << "---------------------------------------------------------------\n";
-    std::cout << "Starting create_all load test\n";
-    std::fill(avg_throughput.begin(), avg_throughput.end(), 0);
-    std::fill(avg_response_time.begin(), avg_response_time.end(), 0);
-    std::fill(num_requests.begin(), num_requests.end(), 0);
-
-    std::vector<std::thread> threads;
-
-    // launch multiple threads
-    for (int i = 0; i < numthreads; ++i)
+    std::string phases = argc > 3 ? argv[3] : "create,read,rotate";
+    std::istringstream phase_list(phases);
+    std::string phase;
+    while (std::getline(phase_list, phase, ','))
     {
-        threads.emplace_back(create_all, i);  // create and start a new thread
-    }
-
-    // wait for all threads to finish
-    for (auto& t : threads)
-    {
-        t.join();
-    }
-    
-    cli.Get("/printStatistics");
-    db_cli.Get("/printStatistics");
-
-    double avg_throug = 0, avg_resp = 0;
-    for (int i = 0; i < numthreads; ++i)
-    {
-        avg_response_time[i] /= num_requests[i];
-        avg_throug += avg_throughput[i];
-        avg_resp += avg_response_time[i];
-    }
-    avg_throug /= duration_seconds;
-    avg_resp /= numthreads;
-    threads.clear();
-
-    std::cout << "Completed create_all load test\n";
-    std::cout << "Average throughput (requests succesfully completed/sec): " << avg_throug << std::endl << "Average response time: " << avg_resp << "(ms) \n";
-    // get_all(): each client will run this.
-    std::cout << "---------------------------------------------------------------\n";
-    std::cout << "Starting read_all load test\n";
-    std::fill(avg_throughput.begin(), avg_throughput.end(), 0);
-    std::fill(avg_response_time.begin(), avg_response_time.end(), 0);
-    std::fill(num_requests.begin(), num_requests.end(), 0);
-
-    // launch multiple threads
-    for (int i = 0; i < numthreads; ++i) {
-        threads.emplace_back(read_all, i);  // create and start a new thread
-    }
-
-    // wait for all threads to finish
-    for (auto& t : threads) {
-        t.join();
-    }
-
-    // prints cpu, mem, disk utilization
-    cli.Get("/printStatistics");
-    db_cli.Get("/printStatistics");
-
-    avg_throug = 0, avg_resp = 0;
-    for (int i = 0; i < numthreads; ++i)
-    {
-        avg_response_time[i] /= num_requests[i];
-        avg_throug += avg_throughput[i];
-        avg_resp += avg_response_time[i];
-    }
-    avg_throug /= duration_seconds;
-    avg_resp /= numthreads;
-    threads.clear();
-
-    std::cout << "Completed read_all load test\n";
-    std::cout << "Average throughput (requests succesfully completed/sec): " << avg_throug << std::endl << "Average response time: " << avg_resp << "(ms) \n";
-    
-    // rotate(): each client will run this. (CPU bound)
-    std::cout << "---------------------------------------------------------------\n";
-    std::cout << "Starting rotate_all load test\n";
-    std::fill(avg_throughput.begin(), avg_throughput.end(), 0);
-    std::fill(avg_response_time.begin(), avg_response_time.end(), 0);
-    std::fill(num_requests.begin(), num_requests.end(), 0);
-
-    
-    // launch multiple threads
-    for (int i = 0; i < numthreads; ++i) {
-        threads.emplace_back(rotate_all, i);  // create and start a new thread
-    }
-
-    // wait for all threads to finish
-    for (auto& t : threads) {
-        t.join();
-    }
-
-    cli.Get("/printStatistics");
-    db_cli.Get("/printStatistics");
-
-    avg_throug = 0, avg_resp = 0;
-    for (int i = 0; i < numthreads; ++i)
-    {
-        avg_response_time[i] /= num_requests[i];
-        avg_throug += avg_throughput[i];
-        avg_resp += avg_response_time[i];
-    }
-    avg_throug /= duration_seconds;
-    avg_resp /= numthreads;
-    threads.clear();
-
-    threads.clear();
-    std::cout << "Completed rotate_all load test\n";
-    std::cout << "Average throughput (requests succesfully completed/sec): " << avg_throug << std::endl << "Average response time: " << avg_resp << "(ms) \n";
-    
-    std::cout << "---------------------------------------------------------------\n";
-    /*
-    // create_read_delete_mix():
-    std::cout << "Starting mix_all load test\n";
-    std::fill(avg_throughput.begin(), avg_throughput.end(), 0);
-    std::fill(avg_response_time.begin(), avg_response_time.end(), 0);
-    std::fill(num_requests.begin(), num_requests.end(), 0);
-
-    // launch multiple threads
-    for (int i = 0; i < numthreads; ++i) {
-        threads.emplace_back(create_read_delete_mix, i);  // create and start a new thread
-    }
-
-    // wait for all threads to finish
-    for (auto& t : threads) {
-        t.join();
-    }
-
-    cli.Get("/printStatistics");
-    db_cli.Get("/printStatistics");
-
-    avg_throug = 0, avg_resp = 0;
-    for (int i = 0; i < numthreads; ++i)
-    {
-        avg_response_time[i] /= num_requests[i];
-        avg_throughput[i] /= duration_seconds;
-        avg_throug += avg_throughput[i];
-        avg_resp += avg_response_time[i];
-    }
-    avg_throug /= numthreads;
-    avg_resp /= numthreads;
-
-    threads.clear();
-
-    std::cout << "Completed mix_all load test\n";
-    std::cout << "Average throughput (requests succesfully completed/sec): " << avg_throug << std::endl << "Average response time: " << avg_resp << "(ms) \n";
-    
-    std::cout << "---------------------------------------------------------------\n";
+        void (*client)(int);
+        if (phase == "create")
+            client = create_all; // IO bound
+        else if (phase == "read")
+            client = read_all;
+        else if (phase == "rotate")
+            client = rotate_all; // CPU bound
+        else if (phase == "delete")
+            client = delete_all;
+        else if (phase == "mix")
+            client = create_read_delete_mix;
+        else if (phase == "zipf")
+            client = zipf_read;
+        else if (phase == "dbstress")
+            client = db_stress;
+        else if (phase == "dbcreate")
+            client = db_create_all;
+        else if (phase == "sizes")
+            client = sizes_all;
+        else if (phase == "rotateflood")
+            client = rotate_flood;
+        else
+        {
+            std::cout << "Unknown load test " << phase << "\n";
+            continue;
+        }
 
-    // delete_all(): 
-    std::cout << "Starting delete_all load test\n";
-    std::fill(avg_throughput.begin(), avg_throughput.end(), 0);
-    std::fill(avg_response_time.begin(), avg_response_time.end(), 0);
-    std::fill(num_requests.begin(), num_requests.end(), 0);
+        std::cout << "---------------------------------------------------------------\n";
+        std::cout << "Starting " << phase << "_all load test\n";
+        std::fill(avg_throughput.begin(), avg_throughput.end(), 0);
+        std::fill(avg_response_time.begin(), avg_response_time.end(), 0);
+        std::fill(num_requests.begin(), num_requests.end(), 0);
+
+        if (phase == "zipf")
+            zipf_populate();
+        if (phase == "sizes")
+            sizes_populate();
+        if (phase == "rotateflood")
+            flood_populate();
+        db_stress_failures = 0;
+        double hits = get_metric(cli, "cache_hits"), misses = get_metric(cli, "cache_misses");
+
+        std::vector<std::thread> threads;
+
+        // launch multiple threads
+        for (int i = 0; i < numthreads; ++i)
+        {
+            threads.emplace_back(client, i);  // create and start a new thread
+        }
 
-    // launch multiple threads
-    for (int i = 0; i < numthreads; ++i) {
-        threads.emplace_back(delete_all, i);  // create and start a new thread
-    }
+        // wait for all threads to finish
+        for (auto& t : threads)
+        {
+            t.join();
+        }
 
-    // wait for all threads to finish
-    for (auto& t : threads) {
-        t.join();
-    }
-    
-    cli.Get("/printStatistics");
-    db_cli.Get("/printStatistics");
+        // prints cpu, mem, disk utilization
+        cli.Get("/printStatistics");
+        db_cli.Get("/printStatistics");
 
-    avg_throug = 0, avg_resp = 0;
-    for (int i = 0; i < numthreads; ++i)
-    {
-        avg_response_time[i] /= num_requests[i];
-        avg_throughput[i] /= duration_seconds;
-        avg_throug += avg_throughput[i];
-        avg_resp += avg_response_time[i];
+        double avg_throug = 0, avg_resp = 0;
+        for (int i = 0; i < numthreads; ++i)
+        {
+            avg_response_time[i] /= num_requests[i];
+            avg_throug += avg_throughput[i];
+            avg_resp += avg_response_time[i];
+        }
+        avg_throug /= duration_seconds;
+        avg_resp /= numthreads;
+
+        std::cout << "Completed " << phase << "_all load test\n";
+        std::cout << "Average throughput (requests succesfully completed/sec): " << avg_throug << std::endl << "Average response time: " << avg_resp << "(ms) \n";
+
+        // hit ratio of the server cache during this load test only.
+        hits = get_metric(cli, "cache_hits") - hits;
+        misses = get_metric(cli, "cache_misses") - misses;
+        if (hits + misses > 0)
+            std::cout << "Cache hit ratio: " << hits / (hits + misses) << "\n";
+        if (phase == "dbstress")
+            std::cout << "Wrong or failed database answers: " << db_stress_failures << "\n";
+        if (phase == "sizes")
+            print_sizes();
+        if (phase == "rotateflood")
+            print_flood();
     }
-    avg_throug /= numthreads;
-    avg_resp /= numthreads;
-
-    threads.clear();
-    std::cout << "Completed delete_all load test\n";
-    std::cout << "Average throughput (requests succesfully completed/sec): " << avg_throug << std::endl << "Average response time: " << avg_resp << "(ms) \n";
     std::cout << "---------------------------------------------------------------\n";
-    */
 }
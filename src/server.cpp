@@ -1,8 +1,15 @@
 #include "include/httplib.h"
+#include "include/cache.h"
+#include "include/negative_cache.h"
+#include "include/singleflight.h"
+#include "include/db_pool.h"
+#include "include/options.h"
+#include "include/cpu_pool.h"
+#include "include/rotate.h"
+#include "include/jpeg_codec.h"
+#include "include/jpeg_rotate.h"
+#include <atomic>
 #include <iostream>
-#include <unordered_map>
-#include <mutex>
-#include <queue>
 #include <string>
 #include <fstream>
 #include <opencv2/opencv.hpp>
@@ -17,8 +24,26 @@ using namespace cv;
 
 #define IP "127.0.0.1"
 #define port 5000
-#define CACHE_SIZE 5
+#define CACHE_BYTES ((size_t)256 << 20) // default cache budget (--cache-bytes), 256 MB.
+#define CACHE_MAX_OBJECT_FRACTION 0.05 // default for --cache-max-object-fraction.
+#define CACHE_SHARDS 16 // number of independently locked parts of the cache.
+#define CACHE_POLICY "lru" // default eviction policy (--cache-policy): fifo, lru, clock, s3fifo or wtinylfu.
+#define NEGATIVE_CACHE_ENTRIES 100000 // default for --negative-cache-entries, 0 disables the negative cache.
+#define NEGATIVE_CACHE_TTL_MS 2000 // default for --negative-cache-ttl-ms.
 #define DATABASE_ADDRESS "http://127.0.0.1:5001"
+#define DB_CONNECTIONS 4 // default for --db-connections, keep-alive connections to the database.
+#define DB_HEALTH_CHECK_MS 10000 // default for --db-health-check-ms, idle time after which a connection is checked.
+#define KEY_NOT_FOUND "Key does not exist." // body of the database's (and server's) answer for a missing key.
+#define KEY_ALREADY_PRESENT "Key already present" // body of the database's answer to /create_if_absent for an existing key.
+#define TRANSFORM_THREADS 0 // default for --transform-threads, rotations run at once. 0 for one per core the server may use.
+#define TRANSFORM_QUEUE 32 // default for --transform-queue, rotations that may wait for a transform thread (0 for no limit).
+#define TRANSFORM_NICE 5 // default for --transform-nice, priority of the transform threads. Handler threads have 0.
+#define SERVER_THREADS 64 // httplib threads. Handlers waiting for a rotation hold one each.
+#define SERVER_BUSY "Server busy, try again later." // body of the 503 answer when the rotation queue is full.
+#define SERVER_CORES 1 // default for --server-cores, cores the server is pinned to, from CPU_core_id on.
+#define ROTATE_TILES 1 // default for --rotate-tiles, row tiles one warpAffine is split into (1 for none).
+#define ROTATE_PARALLEL_MIN_PIXELS (1 << 20) // default for --rotate-parallel-min-pixels, smaller images are not split.
+#define JPEG_QUALITY 95 // of rotated images that are encoded again, imencode's default.
 #define CPU_core_id 0 // used to pin the process to core. used for load testing.
 
 struct CpuTimes {
@@ -103,28 +128,32 @@ void printStats() {
 }
 
 
-// This function stores a (key, value) pair in the cache, evicting a pair if cache is already full.
-void store_in_cache(std::unordered_map<std::string, std::string>& CACHE,
-                    std::list<std::string>& queue_of_keys, 
-                    std::string& key, 
-                    std::string& value)
+// Sends an image that is held in a shared buffer (e.g. straight out of the cache) without copying it.
+// The response keeps a reference to the buffer until it has been written to the socket.
+void send_image(httplib::Response& res, const CacheValue& image)
 {
-    if (CACHE.size() == CACHE_SIZE) // evict an element when cache is full.
-    {
-        std::string front = queue_of_keys.front();
-        CACHE.erase(front); // FCFS policy.
-        queue_of_keys.pop_front(); 
-    }
-
-    queue_of_keys.push_back(key);
-    CACHE[key] = value;
+    res.set_content_provider(image->size(), "image/jpeg",
+        [image](size_t offset, size_t length, httplib::DataSink& sink) {
+            return sink.write(image->data() + offset, length);
+        });
 }
 
-int main()
+// Outcome of looking a key up in the caches and, if needed, the database.
+struct ReadResult
+{
+    enum Status { FOUND, NOT_FOUND, DB_ERROR } status;
+    CacheValue value; // the image, if FOUND.
+};
+
+int main(int argc, char* argv[])
 {
+    Options opts(argc, argv);
+
+    size_t server_cores = std::max(opts.get("server-cores", (size_t)SERVER_CORES), (size_t)1);
     cpu_set_t cpuset;
     CPU_ZERO(&cpuset);          // Clear the CPU set
-    CPU_SET(CPU_core_id, &cpuset);  // Add core_id to the set
+    for (size_t i = 0; i < server_cores; i++)
+        CPU_SET(CPU_core_id + i, &cpuset);  // Add core_id (and the cores after it) to the set
 
     pid_t pid = getpid();  // Current process ID
 
@@ -134,13 +163,119 @@ int main()
         return 1;
     }
 
-    std::cout << "Pinned server process " << pid << " to CPU core " << CPU_core_id << std::endl;
+    std::cout << "Pinned server process " << pid << " to CPU core " << CPU_core_id;
+    if (server_cores > 1)
+        std::cout << " .. " << CPU_core_id + server_cores - 1;
+    std::cout << std::endl;
+    // A rotation runs on one thread unless rotate_image splits it (see below), not on OpenCV's own
+    // threads, which would split every warpAffine over all the cores whatever its size.
+    setNumThreads(1);
 
     httplib::Server svr;
-    std::unordered_map<std::string, std::string> CACHE; // Hash table as a cache to store kv pairs.
-    std::list<std::string> queue_of_keys; // stores the order in which keys arrive. std::list is implemented as a doubly-linked list.
-    std::mutex m; // lock used when storing data into CACHE.
-    httplib::Client db_cli(DATABASE_ADDRESS);
+    // A keep-alive connection holds an httplib thread until it closes, so more threads than the
+    // default (one per core) keep /read answered while clients wait for rotations.
+    svr.new_task_queue = [] { return new httplib::ThreadPool(SERVER_THREADS); };
+    // Hash table as a cache to store kv pairs, split into shards and bounded by a byte budget.
+    size_t cache_bytes = opts.get("cache-bytes", CACHE_BYTES);
+    std::string cache_policy = opts.get("cache-policy", std::string(CACHE_POLICY));
+    if (!is_policy_name(cache_policy))
+    {
+        std::cerr << "Unknown cache policy " << cache_policy << "\n";
+        return 1;
+    }
+    ShardedCache cache(CACHE_SHARDS, cache_bytes, opts.get("cache-max-object-fraction", CACHE_MAX_OBJECT_FRACTION),
+                       cache_policy);
+    std::cout << "Cache budget " << cache_bytes << " bytes in " << CACHE_SHARDS << " shards, "
+              << cache_policy << " eviction\n";
+    // Keys the database recently said do not exist.
+    NegativeCache negative_cache(opts.get("negative-cache-entries", (size_t)NEGATIVE_CACHE_ENTRIES),
+                                 std::chrono::milliseconds(opts.get("negative-cache-ttl-ms", (size_t)NEGATIVE_CACHE_TTL_MS)));
+    // Connections to the database. Every request checks one out just for the duration of its call.
+    DbPool db_pool(DATABASE_ADDRESS, opts.get("db-connections", (size_t)DB_CONNECTIONS),
+                   std::chrono::milliseconds(opts.get("db-health-check-ms", (size_t)DB_HEALTH_CHECK_MS)));
+    SingleFlight<ReadResult> db_reads; // at most one database read per key in flight.
+    std::atomic<size_t> rotations_lossless{0}, rotations_decoded{0};
+    // Threads that run the rotations, while the handler threads wait (created after the process
+    // is pinned, so by default it has one thread per core of the server).
+    CpuPool transforms(opts.get("transform-threads", (size_t)TRANSFORM_THREADS),
+                       opts.get("transform-queue", (size_t)TRANSFORM_QUEUE),
+                       (int)opts.get("transform-nice", (size_t)TRANSFORM_NICE));
+    std::cout << "Rotations run on " << transforms.stats().threads << " transform threads\n";
+    // warpAffine of an image of at least parallel_min_pixels is split into rotate_tiles row tiles,
+    // which the transform threads that are idle help with.
+    size_t rotate_tiles = std::max(opts.get("rotate-tiles", (size_t)ROTATE_TILES), (size_t)1);
+    size_t parallel_min_pixels = opts.get("rotate-parallel-min-pixels", (size_t)ROTATE_PARALLEL_MIN_PIXELS);
+    ParallelFor parallel_rows = [&](size_t parts, const std::function<void(size_t)>& part) {
+        transforms.parallel_for(parts, part);
+    };
+
+    // Rotates the encoded image in data counter-clockwise by angle degrees into a JPEG in out.
+    // Multiples of 90 degrees of a JPEG are rotated without decoding it where possible (see
+    // jpeg_rotate.h). Everything else is decoded, rotated and encoded again, with the thread's
+    // reusable JPEG codec (see jpeg_codec.h), or OpenCV for images it does not take. False if the
+    // image could not be decoded.
+    auto rotate_encoded = [&](const char* data, size_t size, int angle, std::string& out) -> bool {
+        if (rotate_jpeg(data, size, angle, out))
+        {
+            rotations_lossless++;
+            return true;
+        }
+
+        thread_local Mat img; // decoded images of this thread, the pixels reused while the size stays.
+        if (!decode_jpeg(data, size, img))
+        {
+            // Wrap the binary string in a Mat (no copy) for OpenCV decoding
+            Mat buffer(1, (int)size, CV_8UC1, (void*)data);
+
+            // Decode image from memory
+            img = imdecode(buffer, IMREAD_COLOR);
+            if (img.empty())
+                return false;
+        }
+
+        // Rotate, without interpolation for multiples of 90 degrees (see rotate.h).
+        Mat rotated = rotate_image(img, angle, parallel_rows, img.total() >= parallel_min_pixels ? rotate_tiles : 1);
+
+        // Encode rotated image back to binary string (e.g. JPEG)
+        if (!encode_jpeg(rotated, JPEG_QUALITY, out))
+        {
+            std::vector<uchar> out_buf;
+            imencode(".jpg", rotated, out_buf);
+            out.assign(out_buf.begin(), out_buf.end());
+        }
+        rotations_decoded++;
+        return true;
+    };
+
+    // Finds the image of key in the cache, or else reads it from the database and caches it.
+    // Concurrent misses for the same key share one database read.
+    auto read_through = [&](const std::string& key) -> ReadResult {
+        CacheValue value;
+        if (cache.get(key, value))
+            return {ReadResult::FOUND, value};
+        if (negative_cache.contains(key)) // The database recently said it does not have the key.
+            return {ReadResult::NOT_FOUND, nullptr};
+
+        return db_reads.run(key, [&]() -> ReadResult {
+            uint64_t epoch = negative_cache.epoch();
+            auto res2 = db_pool.checkout()->Get("/read?key=" + key);
+            if (!res2 || res2->status != 200) 
+            {
+                std::cout << "Error in database while reading\n";
+                return {ReadResult::DB_ERROR, nullptr};
+            }
+            if (res2->body == KEY_NOT_FOUND)
+            {
+                negative_cache.insert(key, epoch);
+                return {ReadResult::NOT_FOUND, nullptr};
+            }
+            // Store the key-value pair in cache since it is not in cache. The body is moved into the
+            // shared buffer, which the cache and the waiting requests then all refer to.
+            CacheValue fetched = std::make_shared<const std::string>(std::move(res2->body));
+            cache.put(key, fetched);
+            return {ReadResult::FOUND, fetched};
+        });
+    };
     
     svr.Get("/welcome", [&](const httplib::Request&, httplib::Response& res) {
         res.set_content("Hello, You have connected to an http-based Key-Value server.", "text/plain");
@@ -152,44 +287,37 @@ int main()
         const auto& file = it->second;
 
         std::string key = file.filename;
-        std::string value = file.content; // value is the image
+        CacheValue value = std::make_shared<const std::string>(file.content); // value is the image
 
         // only kept for debugging.
         //std::ofstream ofs(key, std::ios::binary);
-        //ofs << value;
+        //ofs << *value;
         //ofs.close();
         
-        // Read if the key is already present in database
-        auto res2 = db_cli.Get("/read?key=" + key);
-        if (!res2 || res2->status != 200){
-            std::cout << "Error while accessing database.\n";
-            res.set_content("An error occurred in the database.", "text/plain");
-            return;
-        }
-        if (res2->body != "Key does not exist.") // If key is already present in database.
-        {
-            res.set_content("Key already present", "text/plain");
-            return;
-        }
-        
-        // Store the key-value pair in cache since it is a recently used item.
-        m.lock();
-        store_in_cache(CACHE, queue_of_keys, key, value);
-        m.unlock();
-
         // Multipart form upload
         httplib::UploadFormDataItems items = {
-            {"file", value, key, "image/jpeg"}
+            {"file", *value, key, "image/jpeg"}
         };
 
-        // send to database for persistent storage
-        auto res3 = db_cli.Post("/create", items);
+        // The database stores the image only if the key is not there yet, and tells us which
+        // happened, so creating a key takes one round trip and never transfers the old image.
+        auto res3 = db_pool.checkout()->Post("/create_if_absent", items);
         if (!res3 || res3->status != 200)
         {
             std::cout << "Error: Could not create key in database.";
             res.set_content("An error occurred in the database.", "text/plain");
             return;
         }
+        if (res3->body == KEY_ALREADY_PRESENT)
+        {
+            res.set_content(KEY_ALREADY_PRESENT, "text/plain");
+            return;
+        }
+
+        // The key exists now.
+        negative_cache.erase(key);
+        // Store the key-value pair in cache since it is a recently used item.
+        cache.put(key, value);
 
         res.set_content("File uploaded successfully", "text/plain");
     });
@@ -197,30 +325,14 @@ int main()
     // For the "read" command
     svr.Get("/read", [&](const httplib::Request& req, httplib::Response& res) {
         std::string key = req.get_param_value("key");
-        std::string value;
         
-        m.lock();
-        if (CACHE.count(key)) // If key is already in cache, then fetch from it directly.
-        {
-            //std::cout << "CACHE used\n"; // used for debugging
-            value = CACHE[key];
-            m.unlock();
-            res.set_content(value, "image/jpeg");
-        }
-        else // Else fetch from database.
-        {
-            m.unlock();
-            auto res2 = db_cli.Get("/read?key=" + key);
-            if (!res2 || res2->status != 200) 
-            {
-                std::cout << "Error in database while reading\n";
-                res.set_content("An error occurred in the database.", "text/plain");
-                return;
-            }
-            // Store the key-value pair in cache since it is not in cache
-            store_in_cache(CACHE, queue_of_keys, key, res2->body);
-            res.set_content(res2->body, "image/jpeg");
-        }
+        ReadResult r = read_through(key);
+        if (r.status == ReadResult::FOUND)
+            send_image(res, r.value);
+        else if (r.status == ReadResult::NOT_FOUND)
+            res.set_content(KEY_NOT_FOUND, "text/plain");
+        else
+            res.set_content("An error occurred in the database.", "text/plain");
     });
 
     // For the "delete" command
@@ -229,21 +341,23 @@ int main()
         fflush(stdout);
         
         // delete from cache.
-        m.lock();
-        CACHE.erase(key);
-        queue_of_keys.remove(key);
-        m.unlock();
+        cache.erase(key);
 
         // delete from the database.
+        uint64_t epoch = negative_cache.epoch();
         httplib::Params params;
         params.emplace("key", key);
-        auto res2 = db_cli.Post("/delete", params);
+        auto res2 = db_pool.checkout()->Post("/delete", params);
         if (!res2 || res2->status != 200) 
         {
             std::cout << "Error in database while deleting the file\n";
             res.set_content("An error occurred in the database.", "text/plain");
         }
-        else res.set_content("Image deleted successfully.", "text/plain");
+        else
+        {
+            negative_cache.insert(key, epoch); // the key is gone now.
+            res.set_content("Image deleted successfully.", "text/plain");
+        }
     });
 
     // For the rotate command: which takes an image and an angle as an input and rotates the image by that angle in counter-clockwise direction.
@@ -252,42 +366,21 @@ int main()
         const auto& file = it->second;
 
         int angle = std::stoi(file.filename);
-        std::string img_data = file.content;
-
-        // Convert binary string to vector<uchar> for OpenCV decoding
-        std::vector<uchar> buffer(img_data.begin(), img_data.end());
+        const std::string& img_data = file.content;
 
-        // Decode image from memory
-        Mat img = imdecode(buffer, IMREAD_COLOR);
-        if (img.empty()) {
+        std::string rotated_data;
+        bool rotated = false;
+        if (!transforms.run([&] { rotated = rotate_encoded(img_data.data(), img_data.size(), angle, rotated_data); })) {
+            res.status = 503;
+            res.set_content(SERVER_BUSY, "text/plain");
+            return;
+        }
+        if (!rotated) {
             std::cerr << "Error: could not decode image data." << std::endl;
             res.set_content("Error: could not decode image data.", "text/plain");
             return;
         }
 
-        // Get the rotation matrix
-        Point2f center(img.cols / 2.0F, img.rows / 2.0F);
-
-        Mat rotation_matrix = getRotationMatrix2D(center, angle, 1);
-
-        // Compute bounding box so that the rotated image fits completely
-        Rect2f bbox = RotatedRect(Point2f(), img.size(), angle).boundingRect2f();
-
-        // Adjust transformation matrix to keep image centered
-        rotation_matrix.at<double>(0, 2) += bbox.width / 2.0 - img.cols / 2.0;
-        rotation_matrix.at<double>(1, 2) += bbox.height / 2.0 - img.rows / 2.0;
-
-        // Apply the rotation
-        Mat rotated;
-        warpAffine(img, rotated, rotation_matrix, bbox.size());
-
-        // Encode rotated image back to binary string (e.g. JPEG)
-        std::vector<uchar> out_buf;
-        imencode(".jpg", rotated, out_buf);
-
-        // Convert back to std::string
-        std::string rotated_data(out_buf.begin(), out_buf.end());
-
         res.set_content(rotated_data, "image/jpeg");
     });
 
@@ -295,75 +388,45 @@ int main()
     svr.Post("/rotate2", [&](const httplib::Request& req, httplib::Response& res){
         std::string key = req.get_param_value("key");
         int angle = std::stoi(req.get_param_value("angle"));
-        std::string img_data;
         
-        // Get the image.
-        m.lock();
-        if (CACHE.count(key)) // If key is already in cache, then fetch from it directly.
+        // Get the image, from the cache if it is there.
+        ReadResult r = read_through(key);
+        if (r.status == ReadResult::NOT_FOUND)
         {
-            //std::cout << "CACHE used\n"; // used for debugging
-            img_data = CACHE[key];
-            m.unlock();
+            res.set_content(KEY_NOT_FOUND, "text/plain");
+            return;
         }
-        else // Else fetch from database.
+        if (r.status == ReadResult::DB_ERROR)
         {
-            m.unlock();
-            auto res2 = db_cli.Get("/read?key=" + key);
-            if (!res2 || res2->status != 200) 
-            {
-                std::cout << "Error in database while reading\n";
-                res.set_content("An error occurred in the database.", "text/plain");
-                return;
-            }
-            // Store the key-value pair in cache since it is not in cache
-            store_in_cache(CACHE, queue_of_keys, key, res2->body);
-            img_data = res2->body;
+            res.set_content("An error occurred in the database.", "text/plain");
+            return;
         }
+        CacheValue img_data = r.value;
         
-        // Convert binary string to vector<uchar> for OpenCV decoding
-        std::vector<uchar> buffer(img_data.begin(), img_data.end());
-
-        // Decode image from memory
-        Mat img = imdecode(buffer, IMREAD_COLOR);
-        if (img.empty()) {
+        std::string out;
+        bool rotated = false;
+        if (!transforms.run([&] { rotated = rotate_encoded(img_data->data(), img_data->size(), angle, out); })) {
+            res.status = 503;
+            res.set_content(SERVER_BUSY, "text/plain");
+            return;
+        }
+        if (!rotated) {
             std::cerr << "Error: could not decode image data." << std::endl;
             res.set_content("Error: could not decode image data.", "text/plain");
             return;
         }
-
-        // Get the rotation matrix
-        Point2f center(img.cols / 2.0F, img.rows / 2.0F);
-
-        Mat rotation_matrix = getRotationMatrix2D(center, angle, 1);
-
-        // Compute bounding box so that the rotated image fits completely
-        Rect2f bbox = RotatedRect(Point2f(), img.size(), angle).boundingRect2f();
-
-        // Adjust transformation matrix to keep image centered
-        rotation_matrix.at<double>(0, 2) += bbox.width / 2.0 - img.cols / 2.0;
-        rotation_matrix.at<double>(1, 2) += bbox.height / 2.0 - img.rows / 2.0;
-
-        // Apply the rotation
-        Mat rotated;
-        warpAffine(img, rotated, rotation_matrix, bbox.size());
-
-        // Encode rotated image back to binary string (e.g. JPEG)
-        std::vector<uchar> out_buf;
-        imencode(".jpg", rotated, out_buf);
-
-        // Convert back to std::string
-        std::string rotated_data(out_buf.begin(), out_buf.end());
+        CacheValue rotated_data = std::make_shared<const std::string>(std::move(out));
 
         // send to the database for saving.
         // INSERT on the same key UPDATEs the key in cassandra.
         
         // Multipart form upload
         httplib::UploadFormDataItems items = {
-            {"file", rotated_data, key, "image/jpeg"}
+            {"file", *rotated_data, key, "image/jpeg"}
         };
 
         // send to database for persistent storage
-        auto res3 = db_cli.Post("/create", items);
+        auto res3 = db_pool.checkout()->Post("/create", items);
         if (!res3 || res3->status != 200)
         {
             std::cout << "Error: Could not update key in database.";
@@ -371,15 +434,61 @@ int main()
             return;
         }
         // If key was in cache, we also need to update the cache.
-        if (CACHE.count(key))
-        {
-            CACHE[key] = rotated_data;
-        }
+        cache.update(key, rotated_data);
         res.set_content("Image " + key + " rotated and saved in database.", "image/jpeg");
     });
 
+    // Counters of the server, one "name value" pair per line.
+    auto metrics = [&]() {
+        ShardedCache::Stats cs = cache.stats();
+        NegativeCache::Stats ns = negative_cache.stats();
+        DbPool::Stats ps = db_pool.stats();
+        CpuPool::Stats ts = transforms.stats();
+        double lookups = cs.hits + cs.misses;
+        std::ostringstream out;
+        out << "cache_hits " << cs.hits << "\n"
+            << "cache_misses " << cs.misses << "\n"
+            << "cache_hit_ratio " << (lookups > 0 ? cs.hits / lookups : 0) << "\n"
+            << "cache_evictions " << cs.evictions << "\n"
+            << "cache_rejected " << cs.rejected << "\n"
+            << "cache_entries " << cs.entries << "\n"
+            << "cache_used_bytes " << cs.used_bytes << "\n"
+            << "negative_cache_hits " << ns.hits << "\n"
+            << "negative_cache_misses " << ns.misses << "\n"
+            << "negative_cache_entries " << ns.entries << "\n"
+            << "rotations_lossless " << rotations_lossless << "\n"
+            << "rotations_decoded " << rotations_decoded << "\n"
+            << "db_reads " << db_reads.executed() << "\n"
+            << "db_reads_coalesced " << db_reads.coalesced() << "\n"
+            << "db_pool_size " << ps.size << "\n"
+            << "db_pool_idle " << ps.idle << "\n"
+            << "db_pool_checkouts " << ps.checkouts << "\n"
+            << "db_pool_checkouts_waited " << ps.waited << "\n"
+            << "db_pool_avg_wait_ms " << (ps.checkouts > 0 ? ps.total_wait_ms / ps.checkouts : 0) << "\n"
+            << "db_pool_max_wait_ms " << ps.max_wait_ms << "\n"
+            << "db_pool_health_checks " << ps.health_checks << "\n"
+            << "db_pool_reconnects " << ps.reconnects << "\n"
+            << "transform_threads " << ts.threads << "\n"
+            << "transform_queue_depth " << ts.queued << "\n"
+            << "transform_queue_max_depth " << ts.max_queued << "\n"
+            << "transform_jobs " << ts.jobs << "\n"
+            << "transform_rejected " << ts.rejected << "\n"
+            << "transform_avg_wait_ms " << (ts.jobs > 0 ? ts.total_wait_ms / ts.jobs : 0) << "\n"
+            << "transform_max_wait_ms " << ts.max_wait_ms << "\n"
+            << "transform_avg_run_ms " << (ts.jobs > 0 ? ts.total_run_ms / ts.jobs : 0) << "\n"
+            << "transform_split_rotations " << ts.parallel_runs << "\n"
+            << "transform_tiles " << ts.parts << "\n"
+            << "transform_tiles_helped " << ts.parts_helped << "\n";
+        return out.str();
+    };
+
+    svr.Get("/metrics", [&](const httplib::Request& req, httplib::Response& res){
+        res.set_content(metrics(), "text/plain");
+    });
+
     svr.Get("/printStatistics", [&](const httplib::Request& req, httplib::Response& res){
         printStats();
+        std::cout << metrics() << "\n";
         t1 = readIOTime();
         c1 = readCPU();
     });